@@ -0,0 +1,135 @@
+/*
+  Mini Logger - Block Compression Benchmark (host)
+  - Splits log files into writer-sized blocks and packs each with
+    packLogBlock() (Log-compress.h), exactly as LOG_COMPRESS does on the device
+  - Checks every block unpacks byte-for-byte
+  - Reports compression ratio and ns (and, on x86, TSC cycles) per block
+  - Without files, benchmarks a synthetic 10 Hz CSV drive from formatLogLine()
+
+  Build: g++ -std=c++17 -O2 -o compress-bench Compress-bench.cpp
+  Usage: compress-bench [-b block_bytes] [L25061400.CSV ...]
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "Log-compress.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAS_TSC 1
+#endif
+
+#define LOG_LINE_SIZE 64
+#define DEFAULT_BLOCK_BYTES (LOG_LINE_SIZE * 100) // CSV at 10 Hz, 10 s flush
+
+std::vector<uint8_t> readFile(const char *path) {
+  std::vector<uint8_t> data;
+  FILE *f = fopen(path, "rb");
+  if (!f) { perror(path); return data; }
+  uint8_t chunk[4096];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) data.insert(data.end(), chunk, chunk + n);
+  fclose(f);
+  return data;
+}
+
+// 30 minutes of a car lapping at up to ~60 mph, padded to 64-byte lines like bufferLogLine()
+std::vector<uint8_t> syntheticDrive() {
+  const std::string hdr = "lat,lon,speed_mph,UTC_datetime,RPM\r\n";
+  std::vector<uint8_t> data(hdr.begin(), hdr.end());
+  int64_t lat = 523456789, lon = -12345678;
+  for (int i = 0; i < 30 * 60 * 10; ++i) {
+    int speed = 30 + (i / 37) % 30;
+    lat += speed * 3 + (i % 11);
+    lon -= speed * 2 - (i % 7);
+    LogLineFields f;
+    f.locationValid = true;
+    f.lat = LogDegrees{(uint16_t)(lat / 10000000), (uint32_t)(lat % 10000000) * 100, false};
+    f.lon = LogDegrees{(uint16_t)(-lon / 10000000), (uint32_t)(-lon % 10000000) * 100, true};
+    f.speedMph = speed;
+    f.year = 2025; f.month = 6; f.day = 14;
+    int secs = 13 * 3600 + i / 10;
+    f.hour = secs / 3600; f.minute = secs / 60 % 60; f.second = secs % 60;
+    f.millisecond = i % 10 * 100;
+    f.rpm = 1500 + speed * 50 + (i % 13) * 10;
+    char line[80];
+    int len = formatLogLine(line, f);
+    for (int k = len; k < LOG_LINE_SIZE; ++k) line[k] = ' ';
+    data.insert(data.end(), line, line + LOG_LINE_SIZE);
+  }
+  return data;
+}
+
+int main(int argc, char **argv) {
+  size_t blockBytes = DEFAULT_BLOCK_BYTES;
+  std::vector<std::string> files;
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "-b") && i + 1 < argc) blockBytes = strtoul(argv[++i], nullptr, 10);
+    else files.push_back(argv[i]);
+  }
+  if (blockBytes == 0 || blockBytes > 65535) { fprintf(stderr, "block size must be 1..65535\n"); return 2; }
+
+  std::vector<uint8_t> data;
+  if (files.empty()) {
+    data = syntheticDrive();
+    printf("synthetic 10 Hz CSV drive, %zu bytes\n", data.size());
+  }
+  for (const std::string &f : files) {
+    std::vector<uint8_t> d = readFile(f.c_str());
+    data.insert(data.end(), d.begin(), d.end());
+  }
+  if (data.empty()) return 1;
+
+  static uint16_t table[LZ_HASH_SIZE];
+  std::vector<uint8_t> frame(LOG_FRAME_BOUND(blockBytes)), back(blockBytes);
+  size_t blocks = 0, packedBytes = 0, stored = 0;
+  double packNs = 0, unpackNs = 0;
+  uint64_t packCycles = 0;
+
+  for (size_t off = 0; off < data.size(); off += blockBytes) {
+    size_t n = std::min(blockBytes, data.size() - off);
+    auto t0 = std::chrono::steady_clock::now();
+#ifdef BENCH_HAS_TSC
+    uint64_t c0 = __rdtsc();
+#endif
+    size_t len = packLogBlock(&data[off], n, frame.data(), table, (uint8_t)blocks, 0);
+#ifdef BENCH_HAS_TSC
+    packCycles += __rdtsc() - c0;
+#endif
+    auto t1 = std::chrono::steady_clock::now();
+
+    LogBlockFrame f;
+    memcpy(&f, frame.data(), sizeof(f));
+    const uint8_t *payload = frame.data() + sizeof(f);
+    long got = -1;
+    if (logFrameValid(f, payload, 0)) {
+      if (f.method == LOG_FRAME_LZ) got = lzDecompress(payload, f.storedLen, back.data(), back.size());
+      else { memcpy(back.data(), payload, f.storedLen); got = f.storedLen; }
+    }
+    auto t2 = std::chrono::steady_clock::now();
+    if (got != (long)n || memcmp(back.data(), &data[off], n) != 0) {
+      printf("round trip failed at block %zu\n", blocks);
+      return 1;
+    }
+    packNs += std::chrono::duration<double, std::nano>(t1 - t0).count();
+    unpackNs += std::chrono::duration<double, std::nano>(t2 - t1).count();
+    packedBytes += len;
+    stored += f.method == LOG_FRAME_STORED;
+    blocks++;
+  }
+
+  printf("%zu blocks of %zu bytes, all round-trip\n", blocks, blockBytes);
+  printf("%zu -> %zu bytes framed, ratio %.2f:1, %zu stored uncompressed\n", data.size(), packedBytes,
+         (double)data.size() / packedBytes, stored);
+  printf("pack   %10.1f ns/block", packNs / blocks);
+#ifdef BENCH_HAS_TSC
+  printf("  %10.1f cycles/block  %5.1f cycles/byte", (double)packCycles / blocks, (double)packCycles / data.size());
+#endif
+  printf("\nunpack %10.1f ns/block\n", unpackNs / blocks);
+  return 0;
+}
@@ -1,15 +1,39 @@
 /*
   Mini Logger - Full Sketch
-  - 8.3-safe filenames: /LYYMMDDxx.CSV
-  - SD hotplug detection
-  - Debounced button (short click toggles logging)
-  - Buffered logging flushed every FLUSH_INTERVAL_SECONDS
+  - 8.3-safe filenames: /LYYMMDDxx.CSV (or .BIN for LOG_FORMAT_BINARY/DELTA),
+    xx = 00..99 then A0..ZZ; next name from a directory scan cached at mount
+  - SD hotplug detection: a raw sector read (or card-detect pin) per check,
+    remounting only when a card is inserted
+  - SPI clock negotiated per card (read-back tested, kept in NVS); "bench" on
+    Serial measures SD write speed per block size
+  - SD write/sync/open/mount/handoff latency histograms: "lat" on Serial, and
+    #H health records in the log every LOG_HEALTH_SECONDS
+  - Card swap while logging: samples spool in RAM and the session continues in
+    a new file on the next card
+  - Debounced button (short click toggles logging, long press logs a lap marker)
+  - Samples logged at LOG_RATE_HZ on a GPS-aligned, millis()-extrapolated clock
+  - Buffered logging handed to SD at a high-water mark, in the quiet after a
+    GPS burst, or at the latest after FLUSH_INTERVAL_SECONDS
+  - Ping-pong log buffers drained by a dedicated SD writer task
+  - Next log file created in the writer task while idle, so a click starts at once
+  - Log files pre-allocated at creation, trimmed on close or next boot
+  - Long sessions roll over to a new file by size or duration without a gap;
+    each file starts with a #C record naming its predecessor
+  - CSV blocks journaled with sequence number + CRC; torn tails cut at boot
+  - Session header (build, config, start) and a footer of max/mean speed,
+    max RPM, distance, sample count and bounding box kept as samples are buffered
+  - Delta and compressed logs end with a time -> offset seek index of their blocks
+  - FAT/directory sync decoupled from data writes (LOG_SYNC_POLICY)
+  - Last RETAINED_RECORDS samples mirrored in RTC memory, replayed after a reset
+  - Optional LZ block compression in the writer task: /LYYMMDDxx.LZB (LOG_COMPRESS)
+  - Optional raw hall pulse stream /RYYMMDDxx.BIN (PULSE_LOG)
   - OLED shows local time based on GPS longitude
 
   + Added:
     - Hall-effect RPM on IO1
     - 2 pulses/rev
-    - RPM computed at 10 Hz (RPM_UPDATE_HZ)
+    - ISR timestamps every pulse into a lock-free ring
+    - RPM from the average of the last RPM_AVG_PULSES pulse periods
     - Ones digit forced to 0
     - RPM text only appears after first pulse is sensed
     - Same RPM used for OLED + CSV
@@ -21,8 +45,15 @@
 #include <HardwareSerial.h>
 #include <SPI.h>
 #include <SD.h>
+#include <Preferences.h> // SPI clock per card, in NVS
+#include <unistd.h>  // truncate() on the VFS path of the SD mount
+#include <atomic>    // atomic_signal_fence() for the retained ring
+#include "Log-format.h"
+#include "Log-compress.h"
 
 // ==================== CONFIG ====================
+// Settings wrapped in #ifndef can be set from the build instead, e.g.
+// -DLOG_RATE_HZ=25 -DLOG_FORMAT=LOG_FORMAT_BINARY.
 // Pins
 #define SDA_PIN 20
 #define SCL_PIN 21
@@ -32,23 +63,207 @@
 #define SD_MOSI 8
 #define SD_CLK  7
 #define SD_MISO 6
+#define SD_MOUNT_POINT "/sd"   // SD.begin() default; needed for POSIX calls
+#define SD_SPI_SAFE_HZ 4000000UL // SD.begin() default; every card must mount here
+#define SD_SPI_CLOCKS 8000000UL, 10000000UL, 16000000UL, 20000000UL, 26666667UL, 40000000UL // tried in turn on a new card
+#define SD_CLOCK_TEST_BYTES 4096 // written and read back at each clock
+#define SD_BENCH_BYTES (1024UL * 1024) // written per block size by the "bench" command
 #define BUTTON_PIN 10  // Button to GND (INPUT_PULLUP)
+#define VBAT_PIN 0     // supply through a divider, for LOG_SYNC_LOW_VOLTAGE
+#ifndef SD_DETECT_PIN
+#define SD_DETECT_PIN -1 // card-detect switch to GND with a card in (INPUT_PULLUP); -1: none
+#endif
 
 // Hall effect RPM config
 #define HALL_PIN 1            // Hall sensor signal on IO1
+#ifndef PULSES_PER_REV
 #define PULSES_PER_REV 2      // 2 pulses per revolution
-#define RPM_UPDATE_HZ 10      // compute RPM at 10 Hz (every 100 ms)
+#endif
+#ifndef PULSE_LOG
+#define PULSE_LOG 0           // 1: also log every hall edge to /RYYMMDDxx.BIN
+#endif
+#define RPM_RING_SIZE (PULSE_LOG ? 4096 : 64) // pulse timestamps buffered between loop() passes (power of two);
+                                              // 4096 covers a ~200 ms display refresh at 20k pulses/s
+#ifndef RPM_AVG_PULSES
+#define RPM_AVG_PULSES 4      // pulse periods averaged per RPM value
+#endif
+#ifndef RPM_TIMEOUT_US
+#define RPM_TIMEOUT_US 500000UL // no pulse for this long reads as 0 RPM
+#endif
 
 // Timing for button handling (ms)
 #define BUTTON_DEBOUNCE_DELAY 50
 #define BUTTON_LONG_PRESS_TIME 2000
 
 // Logging timing
+#ifndef FLUSH_INTERVAL_SECONDS
 #define FLUSH_INTERVAL_SECONDS 10
-#define LOG_INTERVAL_SECONDS 1
+#endif
+#ifndef LOG_RATE_HZ
+#define LOG_RATE_HZ 10           // samples per second: 1, 5, 10 or 25 (must divide 1000)
+#endif
+#define LOG_SAMPLE_PERIOD_MS (1000UL / LOG_RATE_HZ)
+#if 1000 % LOG_RATE_HZ != 0
+#error "LOG_RATE_HZ must divide 1000"
+#endif
 #define LOG_LINE_SIZE 64
-#define LOG_LINES_MAX ((FLUSH_INTERVAL_SECONDS) / (LOG_INTERVAL_SECONDS))
-const unsigned long BUFFER_FLUSH_INTERVAL_MS = (unsigned long)FLUSH_INTERVAL_SECONDS * 1000UL;
+#define LOG_LINES_MAX ((FLUSH_INTERVAL_SECONDS) * (LOG_RATE_HZ))
+const unsigned long BUFFER_FLUSH_INTERVAL_MS = (unsigned long)FLUSH_INTERVAL_SECONDS * 1000UL; // latency ceiling
+#ifndef FLUSH_HIGH_WATER_PERCENT
+#define FLUSH_HIGH_WATER_PERCENT 75  // hand a buffer to the writer once it is this full
+#endif
+#ifndef FLUSH_IDLE_PERCENT
+#define FLUSH_IDLE_PERCENT 50        // or this full, in the quiet after a GPS burst
+#endif
+#ifndef TRACK_OVERFLOW_RECORDS
+#define TRACK_OVERFLOW_RECORDS 2048  // samples parked in RAM while every buffer waits on SD or the
+                                     // card is out (~3.4 min at 10 Hz, 36 KB)
+#endif
+#ifndef TRACK_MARKER_QUEUE
+#define TRACK_MARKER_QUEUE 8         // markers and health records waiting for room in the track buffer
+#endif
+#ifndef LOG_WRITE_RETRIES
+#define LOG_WRITE_RETRIES 4          // short SD writes are retried after 50, 100, 200, 400 ms
+#endif
+#define LOG_RETRY_BACKOFF_MS 50
+#define GPS_QUIET_MS 20              // no UART bytes for this long ends a burst (~20 chars at 9600 baud)
+
+// Log record format
+#define LOG_FORMAT_CSV 0      // 64-byte space-padded text lines
+#define LOG_FORMAT_BINARY 1   // packed 18-byte LogRecord (Log-format.h), decode with Log-decoder.cpp
+#define LOG_FORMAT_DELTA 2    // zig-zag varint deltas between LogRecords, ~5 bytes/sample
+#ifndef LOG_FORMAT
+#define LOG_FORMAT LOG_FORMAT_CSV
+#endif
+#ifndef LOG_KEYFRAME_SECONDS
+#define LOG_KEYFRAME_SECONDS 10  // LOG_FORMAT_DELTA: full record this often for random access
+#endif
+
+#if LOG_FORMAT == LOG_FORMAT_BINARY
+#define LOG_RECORD_SIZE 18
+#define LOG_FILE_EXT "BIN"
+#elif LOG_FORMAT == LOG_FORMAT_DELTA
+#define LOG_RECORD_SIZE LOG_DELTA_MAX_BYTES // worst case; buffers are filled by bytes
+#define LOG_FILE_EXT "BIN"
+#else
+#define LOG_RECORD_SIZE LOG_LINE_SIZE
+#define LOG_FILE_EXT "CSV"
+#endif
+
+// Block compression: the writer packs each track buffer into a CRC-checked
+// LogBlockFrame before it goes to SD (any LOG_FORMAT; Log-decoder.cpp unpacks)
+#ifndef LOG_COMPRESS
+#define LOG_COMPRESS 0
+#endif
+#if LOG_COMPRESS
+#undef LOG_FILE_EXT
+#define LOG_FILE_EXT "LZB"
+#endif
+
+// What the writer wraps around each block it writes (LogStream.blocks)
+#define LOG_BLOCKS_RAW     0
+#define LOG_BLOCKS_JOURNAL 1   // CSV: #J trailer line with seq + crc (Log-format.h)
+#define LOG_BLOCKS_PACKED  2   // LOG_COMPRESS: numbered, crc-checked LogBlockFrame
+#if LOG_COMPRESS
+#define LOG_TRACK_BLOCKS LOG_BLOCKS_PACKED
+#elif LOG_FORMAT == LOG_FORMAT_CSV
+#define LOG_TRACK_BLOCKS LOG_BLOCKS_JOURNAL
+#else
+#define LOG_TRACK_BLOCKS LOG_BLOCKS_RAW
+#endif
+
+// SD writer task
+#ifndef LOG_BUFFER_COUNT
+#define LOG_BUFFER_COUNT 2        // one filled by loop(), the rest queued/written by the writer
+#endif
+#define LOG_WRITER_STACK 4096
+#define LOG_WRITER_PRIORITY 1     // same as loopTask so both get time slices
+#define GPS_RX_BUFFER_SIZE 1024   // UART headroom while the writer holds the SPI bus
+#define LOG_SECTOR_SIZE 512       // writer only issues whole-sector writes; the tail is carried over
+#define PULSE_BUFFER_COUNT 4
+#define PULSE_BUFFER_SIZE 4096    // ~2000 pulses at 20k pulses/s; handed off whenever full
+
+// Metadata sync: data blocks stream out as they fill; File.flush() (f_sync:
+// FatFs buffer, FAT and directory entry) runs on this schedule instead
+#define LOG_SYNC_EVERY_BLOCK 0   // after every block: a power cut loses at most that block
+#define LOG_SYNC_INTERVAL    1   // every LOG_SYNC_INTERVAL_SECONDS
+#define LOG_SYNC_ON_CLOSE    2   // only when the log is closed
+#define LOG_SYNC_LOW_VOLTAGE 3   // on close, and as soon as the supply drops below LOW_VOLTAGE_MV
+#ifndef LOG_SYNC_POLICY
+#define LOG_SYNC_POLICY LOG_SYNC_INTERVAL
+#endif
+#ifndef LOG_SYNC_INTERVAL_SECONDS
+#define LOG_SYNC_INTERVAL_SECONDS 30
+#endif
+#ifndef LOG_HEALTH_SECONDS
+#define LOG_HEALTH_SECONDS 300   // SD latency health records (#H) this often while logging; 0 = never
+#endif
+#define VBAT_DIVIDER 2           // VBAT_PIN reads supply / VBAT_DIVIDER
+#define LOW_VOLTAGE_MV 3400
+#define LOW_VOLTAGE_HYSTERESIS_MV 100
+#define LOW_VOLTAGE_CHECK_MS 500
+#define LOG_BLOCK_SYNC 0xFF      // LogBlockRef.index asking the writer to sync a stream
+#define LOG_BLOCK_PREPARE 0xFE   // LogBlockRef.index asking the writer to create the next log
+#define LOG_BLOCK_ROLLOVER 0xFD  // LogBlockRef.index asking the writer to continue a stream in its next file
+
+// Rollover: a session continues in a new log after this long or once this many
+// track bytes (before compression) were written; 0 disables either. The next
+// file is opened before the old one is closed, and starts with a #C record
+// naming its predecessor.
+#ifndef LOG_ROLLOVER_MINUTES
+#define LOG_ROLLOVER_MINUTES 60
+#endif
+#ifndef LOG_ROLLOVER_BYTES
+#define LOG_ROLLOVER_BYTES (16UL * 1024 * 1024)
+#endif
+
+// Recorded in each file's LOG_EVENT_SESSION header
+#define LOG_CONFIG (LOG_FORMAT | (LOG_COMPRESS ? LOG_CFG_COMPRESS : 0) | (PULSE_LOG ? LOG_CFG_PULSE : 0) | \
+                    LOG_SYNC_POLICY << 4)
+#define TRACK_FOOTER_BYTES (4 * LOG_JOURNAL_LINE_SIZE) // LOG_EVENT_TOTALS..BOUNDS, as CSV lines at worst
+
+// File pre-allocation: clusters for this many hours (or one rollover period,
+// if shorter) are reserved when a log is created so appends never touch the
+// FAT; 0 disables.
+#ifndef LOG_PREALLOC_HOURS
+#define LOG_PREALLOC_HOURS 4
+#endif
+#if LOG_ROLLOVER_MINUTES > 0 && LOG_ROLLOVER_MINUTES < LOG_PREALLOC_HOURS * 60
+#define LOG_PREALLOC_SECONDS (LOG_ROLLOVER_MINUTES * 60UL)
+#else
+#define LOG_PREALLOC_SECONDS (LOG_PREALLOC_HOURS * 3600UL)
+#endif
+#if LOG_TRACK_BLOCKS == LOG_BLOCKS_JOURNAL
+#define LOG_PREALLOC_BLOCK_BYTES LOG_SECTOR_SIZE // trailer and pad lines of a block handed off half full
+#else
+#define LOG_PREALLOC_BLOCK_BYTES 0
+#endif
+#define LOG_PREALLOC_BYTES ((((uint32_t)LOG_PREALLOC_SECONDS * LOG_RATE_HZ * LOG_RECORD_SIZE) \
+                             + LOG_PREALLOC_SECONDS * 2 / FLUSH_INTERVAL_SECONDS * LOG_PREALLOC_BLOCK_BYTES \
+                             + LOG_SECTOR_SIZE - 1) / LOG_SECTOR_SIZE * LOG_SECTOR_SIZE)
+
+// Seek index: delta and compressed logs, whose offsets cannot be computed
+// from a time, end with a time -> offset entry per block. Past this many
+// entries a file keeps every 2nd block, then every 4th, and so on.
+#define LOG_SEEK_INDEX (LOG_FORMAT == LOG_FORMAT_DELTA || LOG_COMPRESS)
+#ifndef LOG_SEEK_INDEX_ENTRIES
+#define LOG_SEEK_INDEX_ENTRIES 512   // 4 KB
+#endif
+
+// Retained ring: every track sample is also kept in RTC memory, which survives
+// watchdog, panic and brownout resets (not power-on), and samples that never
+// reached the card are appended to their log at the next boot. 0 disables;
+// compressed logs are framed per block, so LOG_COMPRESS turns it off.
+#ifndef RETAINED_RECORDS
+#define RETAINED_RECORDS 256     // power of two; 25 s at 10 Hz in 4.6 KB of the 8 KB RTC RAM
+#endif
+#if LOG_COMPRESS
+#undef RETAINED_RECORDS
+#define RETAINED_RECORDS 0
+#endif
+#define RETAINED_MAGIC (0x52540000UL | LOG_FORMAT << 8 | LOG_RATE_HZ) // "RT", format, rate
+
+#define LOG_NAME_CACHE_SIZE 16       // dates whose next file index is kept after the mount scan
 
 // Display & GPS objects
 Adafruit_SH1107 display(128, 128, &Wire);
@@ -67,25 +282,220 @@ const unsigned char dot16x16[] PROGMEM = {
 };
 
 // ==================== STATE ====================
-bool sdInserted = false;
+volatile bool sdInserted = false;        // set by loop(); the writer reads it, and probes while it is false in a swap
+struct LogNameSlot { uint32_t date; int next; }; // date is YYMMDD
+LogNameSlot logNameCache[LOG_NAME_CACHE_SIZE];
+uint8_t logNameCount = 0;
+long logNameFloor = -1;                    // dates <= this were evicted from the cache
+bool logNamesScanned = false;              // cache matches the card in the slot
 bool isLogging = false;
 unsigned long lastBlinkTime = 0;
 bool blinkState = false;
-int lastLoggedSecond = -1;
-
-char logBuffer[LOG_LINE_SIZE * LOG_LINES_MAX];
-size_t logLinesCount = 0;
-
-String currentLogFileName = "";
-File logFile;
-unsigned long lastBufferFlushMillis = 0;
+int64_t lastLoggedSlot = -1;       // LOG_SAMPLE_PERIOD_MS slot since 2000 last logged
+
+// One file fed through the writer task. loop() appends to the fill buffer; full
+// buffers travel to the writer on logFullQueue and come back on freeQueue.
+struct LogStream {
+  uint8_t id;               // index in logStreams[]
+  char *buffers;            // bufferCount * bufferSize bytes
+  size_t bufferSize;
+  uint8_t bufferCount;
+  size_t *bufferBytes;      // bytes handed to the writer per buffer
+  uint8_t blocks;           // LOG_BLOCKS_*
+  QueueHandle_t freeQueue = NULL;
+  uint8_t fillIndex = 0;    // buffer currently filled by loop()
+  size_t fillBytes = 0;
+  unsigned long fillStartMillis = 0; // when the oldest byte in the fill buffer was appended
+  uint32_t fileBytes = 0;   // appended for the current file
+  String nextName{};        // file the next LOG_BLOCK_ROLLOVER switches to
+  // Writer side, touched only with sdMutex held
+  String fileName{};
+  File file{};
+  size_t dataEnd = 0;       // end of real data, sectorTail included; the file may be longer when pre-allocated
+  uint8_t sectorTail[LOG_SECTOR_SIZE] = {}; // partial last sector, written whole with the next block
+  size_t sectorTailLen = 0;
+  uint32_t journalSeq = 0;  // next block number
+  unsigned long lastSyncMillis = 0;
+  uint32_t journalSalt = 0; // random per file
+};
+struct LogBlockRef { uint8_t stream; uint8_t index; uint8_t epoch; }; // epoch: logSwapEpoch at handoff
+
+char logBuffer[LOG_BUFFER_COUNT][LOG_RECORD_SIZE * LOG_LINES_MAX];
+size_t logBufferBytes[LOG_BUFFER_COUNT];
+LogStream gpsLog = {0, logBuffer[0], sizeof(logBuffer[0]), LOG_BUFFER_COUNT, logBufferBytes, LOG_TRACK_BLOCKS};
+static_assert(sizeof(logBuffer[0]) <= 65535, "LogBlockFrame lengths are 16-bit");
+
+#if PULSE_LOG
+char pulseBuffer[PULSE_BUFFER_COUNT][PULSE_BUFFER_SIZE];
+size_t pulseBufferBytes[PULSE_BUFFER_COUNT];
+LogStream pulseLog = {1, pulseBuffer[0], PULSE_BUFFER_SIZE, PULSE_BUFFER_COUNT, pulseBufferBytes, LOG_BLOCKS_RAW};
+LogStream *const logStreams[] = {&gpsLog, &pulseLog};
+#else
+LogStream *const logStreams[] = {&gpsLog};
+#endif
+#define LOG_STREAM_COUNT (sizeof(logStreams) / sizeof(logStreams[0]))
+
+QueueHandle_t logFullQueue = NULL;       // LogBlockRef of buffers waiting for SD
+SemaphoreHandle_t sdMutex = NULL;        // guards SD.* and stream files between loop() and writer
+volatile bool logWriteFailed = false;    // set by writer, reported by loop()
+volatile bool logRolloverPending = false; // set by loop() with a LOG_BLOCK_ROLLOVER, cleared by writer
+
+// SD write statistics for the current session
+volatile uint32_t sdWriteCount = 0;      // File.write() calls
+volatile uint32_t sdWriteBytes = 0;
+volatile uint32_t sdWriteMicros = 0;     // time spent inside write()
+volatile uint32_t sdWriteMaxMicros = 0;  // slowest single write()
+volatile uint32_t sdSyncCount = 0;       // metadata syncs, File.close() included
+volatile uint32_t sdSyncMicros = 0;
+volatile uint32_t sdSyncMaxMicros = 0;
+volatile uint32_t sdWriteRetries = 0;    // short writes retried
+volatile uint32_t sdReopens = 0;         // successful reopens during retries
+
+// SD operation times (LOG_LAT_*) in log2 buckets: bucket k holds 2^k..2^(k+1)-1 us
+struct LatencyHist {
+  uint32_t counts[LOG_LAT_BUCKETS];
+  uint32_t total;
+  uint32_t maxMicros;
+};
+LatencyHist sdLatency[LOG_LAT_KINDS];       // since boot, for the "lat" command
+LatencyHist sdLatencyWindow[LOG_LAT_KINDS]; // since the last health record
+portMUX_TYPE latencyMux = portMUX_INITIALIZER_UNLOCKED; // both, between the writer and loop()
+unsigned long lastHealthMillis = 0;
+
+#if RETAINED_RECORDS
+// Valid while magic == RETAINED_MAGIC and nameCrc matches; cleared on close
+struct RetainedLog {
+  uint32_t magic;
+  uint32_t size;            // sizeof(RetainedLog), so a build with another ring never trusts it
+  uint32_t nameCrc;
+  char fileName[16];        // /LYYMMDDxx.EXT
+  uint32_t head;            // samples retained since the log the session started in
+  uint32_t first;           // head at this log's first sample
+  uint32_t end;             // head after its last one once a rollover is queued; RETAINED_OPEN before
+  LogRecord ring[RETAINED_RECORDS];
+};
+#define RETAINED_OPEN 0xFFFFFFFFUL
+static_assert((RETAINED_RECORDS & (RETAINED_RECORDS - 1)) == 0, "RETAINED_RECORDS must be a power of two");
+RTC_NOINIT_ATTR RetainedLog retained;
+#endif
+
+// Why loop() handed a buffer to the writer (scheduleLogFlush()), counted per session
+enum FlushReason { FLUSH_FULL, FLUSH_HIGH_WATER, FLUSH_IDLE, FLUSH_LATENCY, FLUSH_ROLLOVER, FLUSH_REASONS };
+const char *const flushReasonNames[FLUSH_REASONS] = {"full", "high-water", "idle", "latency", "rollover"};
+uint32_t flushCounts[FLUSH_REASONS];
+uint32_t flushMicros = 0;                // time spent handing off
+uint32_t flushMaxMicros = 0;
+uint32_t flushFillPercentSum = 0;        // buffer fill at handoff
+uint32_t trackDropped = 0;               // samples lost because no buffer or overflow slot was free
+LogRecord trackOverflow[TRACK_OVERFLOW_RECORDS]; // FIFO in front of the track buffer
+uint16_t trackOverflowTail = 0;
+uint16_t trackOverflowCount = 0;
+uint16_t trackOverflowPeak = 0;
+LogEventRecord lossLogged;               // loss totals last written into the current file
+LogEventRecord trackMarkers[TRACK_MARKER_QUEUE]; // events not yet in the track buffer, oldest first
+uint8_t trackMarkerCount = 0;
+uint16_t markerCounts[LOG_MARK_KINDS + 1]; // markers of each kind this session
+char trackFileName[16];                  // file loop() is filling, /LYYMMDDxx.EXT
+unsigned long trackFileStartMillis = 0;  // when loop() started filling it
+
+// Footer statistics for the file loop() is filling, kept as samples are buffered
+struct TrackStats {
+  uint32_t samples;
+  double metres;
+  uint32_t speedSamples;
+  uint64_t speedSum;       // mph
+  uint8_t maxSpeed;
+  uint16_t maxRpm;
+  bool located;            // the fields below are set
+  int32_t lastLat, lastLon;
+  int32_t minLat, minLon, maxLat, maxLon;
+};
+TrackStats trackStats;
+TrackStats trackBufferStats[LOG_BUFFER_COUNT]; // the samples in each track buffer; cleared by the writer
+
+#if LOG_SEEK_INDEX
+// First sample time per track buffer: set by loop(), taken by the writer into
+// the index of the file it is writing
+bool trackBufferSampled[LOG_BUFFER_COUNT];
+uint32_t trackBufferTime[LOG_BUFFER_COUNT];
+LogIndexEntry seekIndex[LOG_SEEK_INDEX_ENTRIES];
+uint16_t seekIndexCount = 0;
+uint32_t seekIndexStride = 1;            // blocks per entry
+uint32_t seekIndexBlocks = 0;            // blocks with a sample written to this file
+#endif
+int gpsRxPeak = 0;                       // deepest UART backlog seen by loop()
+uint32_t gpsFailedChecksumStart = 0;     // gps.failedChecksum() when the file was opened
+unsigned long lastGpsByteMillis = 0;
+bool gpsBurstPending = false;            // bytes arrived since the last quiet period
+
+// Next log prepared ahead of the click (LOG_BLOCK_PREPARE)
+#define LOG_PREPARE_NONE      0
+#define LOG_PREPARE_REQUESTED 1   // queued to the writer
+#define LOG_PREPARE_READY     2   // gpsLog (and pulseLog) hold the open, synced file
+#define LOG_PREPARE_FAILED    3   // the click opens one itself
+volatile uint8_t logPrepareState = LOG_PREPARE_NONE;
+uint32_t preparedDate = 0;               // YYMMDD the prepared name was allocated for
+bool logStartPending = false;            // report click-to-first-sample on the next sample
+unsigned long logStartMillis = 0;        // millis() of the click
+uint32_t logStartOpenMicros = 0;         // time the click spent getting a file
+bool logStartPrepared = false;
+
+// Card pulled while logging: the session carries on in RAM until the next card
+#define SD_SWAP_NONE    0
+#define SD_SWAP_OUT     1   // the writer holds its block and looks for the next card; loop() spools samples
+#define SD_SWAP_RESUME  2   // continuation files named: the writer opens them
+#define SD_SWAP_MOUNTED 3   // the writer mounted and scanned the next card: loop() names the files
+#define SD_SWAP_POLL_MS 50
+volatile uint8_t sdSwapState = SD_SWAP_NONE;
+volatile uint8_t logSwapEpoch = 0;       // bumped per swap; pulse blocks from before it are dropped
+unsigned long sdSwapStartMillis = 0;
+uint32_t sdSwapDroppedStart = 0;         // trackDropped when the card went
+uint8_t swapPreamble[LOG_LINE_SIZE + 3 * LOG_JOURNAL_LINE_SIZE]; // continuation file's first block, from loop()
+size_t swapPreambleLen = 0;
+
+bool lowVoltage = false;                 // below LOW_VOLTAGE_MV, until back above it plus hysteresis
+unsigned long lastVoltageCheckMillis = 0;
+
+#if LOG_COMPRESS
+// Writer-task scratch for packLogBlock(), and its statistics for the current file
+uint16_t lzHashTable[LZ_HASH_SIZE];
+uint8_t lzFrameBuffer[LOG_FRAME_BOUND(sizeof(logBuffer[0]))];
+volatile uint32_t lzBlocks = 0;
+volatile uint32_t lzRawBytes = 0;
+volatile uint32_t lzPackedBytes = 0;     // including frame headers
+volatile uint32_t lzMicros = 0;
+volatile uint32_t lzMaxMicros = 0;
+#endif
 
 // RPM state
 int RPM = 0; // used for OLED + CSV
-volatile unsigned long pulseCount = 0;
-unsigned long lastRPMSampleMillis = 0;
 bool rpmSeen = false; // tracks if first pulse has ever been detected
 
+// Pulse ring: hallISR() is the only writer of pulseHead, loop() the only writer of pulseTail
+volatile uint32_t pulseTimes[RPM_RING_SIZE];
+volatile uint32_t pulseHead = 0;
+uint32_t pulseTail = 0;
+
+// Sliding window of the last RPM_AVG_PULSES pulse periods (us)
+uint32_t pulsePeriods[RPM_AVG_PULSES];
+uint32_t pulsePeriodSum = 0;
+uint8_t pulsePeriodCount = 0;
+uint8_t pulsePeriodNext = 0;
+uint32_t lastPulseMicros = 0;
+bool havePulse = false;
+
+#if LOG_FORMAT == LOG_FORMAT_DELTA
+// Delta track encoder state (LOG_FORMAT_DELTA), reset per file
+LogRecord deltaPrev;               // last record written
+uint32_t deltaSinceKeyframe = 0;   // records since the last keyframe; 0 forces one
+#endif
+
+// Raw pulse stream (PULSE_LOG)
+uint32_t pulseLogLastMicros = 0;   // last pulse written, deltas count from here
+uint32_t pulseDropped = 0;         // pulses lost to ring or buffer overruns this file
+uint32_t pulseDropsLogged = 0;     // value of the last PULSE_REC_DROPS written
+volatile uint32_t pulseRolloverMicros = 0; // baseMicros for the pulse file a rollover opens
+
 // Button handling
 bool buttonJustClicked = false;
 bool buttonLongPressed = false;
@@ -110,6 +520,18 @@ const unsigned long DISPLAY_UPDATE_INTERVAL_MS = 200;
 // SD hotplug detection control
 unsigned long lastSDCheckMillis = 0;
 const unsigned long SD_CHECK_INTERVAL_MS = 2000;
+const unsigned long SD_DETECT_SETTLE_MS = 250; // card-detect switch bounce after an edge
+#if SD_DETECT_PIN >= 0
+volatile bool sdDetectChanged = false;  // set by the card-detect interrupt
+volatile unsigned long sdDetectMillis = 0;
+#endif
+uint32_t sdProbeCount = 0;              // presence checks this session
+uint32_t sdProbeMicros = 0;
+uint32_t sdProbeMaxMicros = 0;
+const uint32_t sdSpiClocks[] = {SD_SPI_CLOCKS};
+uint32_t sdSpiHz = SD_SPI_SAFE_HZ;      // clock the card is mounted at
+uint8_t sdSector[LOG_SECTOR_SIZE];      // raw sector reads, under sdMutex
+Preferences sdClockPrefs;               // "c<id>": the clock card id passed at
 
 // File created message control
 bool showFileCreatedMsg = false;
@@ -118,17 +540,99 @@ const unsigned long FILE_CREATED_MSG_DURATION_MS = 3000; // 3 seconds
 
 // GPS & date/time helpers
 struct LocalTime { int hour; int minute; int second; };
+
+// Sample clock: last GPS time-of-day, extrapolated with millis() between fixes
+struct SampleTime { int32_t days; uint32_t msOfDay; }; // days since 2000-01-01 UTC
+bool gpsClockValid = false;
+uint32_t gpsClockValue = 0;         // gps.time.value() (HHMMSSCC) of the anchor
+SampleTime gpsClockAnchor = {0, 0};
+unsigned long gpsClockMillis = 0;   // millis() when the anchor was parsed
+uint32_t gpsClockMicros = 0;        // micros() at the same moment, for the pulse stream
 unsigned long loggingStartMillis = 0; // <-- fixed declaration
 
+void bufferPulse(uint32_t t);
+void bufferPulseSync();
+bool appendLogBytes(LogStream &s, const void *data, size_t len);
+void syncLogStream(LogStream &s, bool close = false);
+bool appendJournalBlock(LogStream &s, const char *data, size_t len);
+void drainTrackOverflow();
+void drainTrackMarkers();
+void captureLogRecord(LogRecord &rec, const SampleTime &t);
+void logLossCounters(const LogRecord &at);
+LogRecord eventStamp();
+bool appendTrackEvent(const LogEventRecord &ev);
+bool queueTrackEvent(const LogEventRecord &ev);
+void appendTrackFooter(const LogRecord &at);
+void discardPreparedLog();
+void awaitLogSwap();
+bool sdCardGone();
+bool probeSDCard();
+
 // ==================== RPM ISR ====================
-void IRAM_ATTR hallISR() { pulseCount++; }
+void IRAM_ATTR hallISR() {
+  uint32_t head = pulseHead;
+  pulseTimes[head & (RPM_RING_SIZE - 1)] = micros();
+  pulseHead = head + 1;
+}
+
+#if SD_DETECT_PIN >= 0
+void IRAM_ATTR sdDetectISR() {
+  sdDetectMillis = millis();
+  sdDetectChanged = true;
+}
+#endif
+
+// ==================== RPM FROM PULSE PERIODS ====================
+void resetPulsePeriods() {
+  pulsePeriodSum = 0; pulsePeriodCount = 0; pulsePeriodNext = 0;
+}
+
+void addPulsePeriod(uint32_t period) {
+  if (pulsePeriodCount == RPM_AVG_PULSES) pulsePeriodSum -= pulsePeriods[pulsePeriodNext];
+  else pulsePeriodCount++;
+  pulsePeriods[pulsePeriodNext] = period;
+  pulsePeriodSum += period;
+  pulsePeriodNext = (pulsePeriodNext + 1) % RPM_AVG_PULSES;
+}
+
+// Drains the pulse ring and recomputes RPM (ones digit forced to 0).
+void updateRPM() {
+  uint32_t head = pulseHead;
+  if (head - pulseTail >= RPM_RING_SIZE) { // overrun: gap in the train
+    uint32_t resume = head - RPM_RING_SIZE / 2;
+    pulseDropped += resume - pulseTail;
+    pulseTail = resume;
+    havePulse = false;
+  }
+  while (pulseTail != head) {
+    uint32_t t = pulseTimes[pulseTail & (RPM_RING_SIZE - 1)];
+    pulseTail++;
+    bufferPulse(t);
+    if (havePulse) addPulsePeriod(t - lastPulseMicros);
+    lastPulseMicros = t;
+    havePulse = true;
+    rpmSeen = true;
+  }
+
+  uint32_t sinceLast = micros() - lastPulseMicros;
+  if (!havePulse || sinceLast > RPM_TIMEOUT_US) { havePulse = false; resetPulsePeriods(); RPM = 0; return; }
+  if (pulsePeriodSum == 0) return;
+
+  // A pulse overdue by half an average period means the engine is slowing: use
+  // the elapsed time. Any less is jitter, since a read lands on average
+  // halfway between two pulses.
+  uint32_t avgPeriod = pulsePeriodSum / pulsePeriodCount;
+  uint32_t rpmInt = sinceLast > avgPeriod + avgPeriod / 2
+    ? 60000000UL / PULSES_PER_REV / sinceLast
+    : 60000000UL / PULSES_PER_REV * pulsePeriodCount / pulsePeriodSum;
+  RPM = (rpmInt / 10) * 10;
+}
 
 // Convert GPS time + longitude to local time
-LocalTime getLocalTime(TinyGPSDate date, TinyGPSTime time, double longitude) {
+LocalTime getLocalTime(TinyGPSDate date, TinyGPSTime time, double /*longitude*/) {
   int timezoneOffsetHours = -5;
   int month = date.month();
   int day = date.day();
-  int hour = time.hour();
   if (month>3 && month<11) timezoneOffsetHours = -5;
   else if (month==3 && day>=8) timezoneOffsetHours = -4;
   else if (month==11 && day<=7) timezoneOffsetHours = -4;
@@ -146,6 +650,38 @@ LocalTime getLocalTime(TinyGPSDate date, TinyGPSTime time, double longitude) {
   return LocalTime{h, m, s};
 }
 
+int32_t rawDegreesToE7(const RawDegrees &raw) {
+  int32_t v = (int32_t)raw.deg * 10000000L + (int32_t)((raw.billionths + 50) / 100);
+  return raw.negative ? -v : v;
+}
+
+LogDegrees toLogDegrees(const RawDegrees &raw) { return LogDegrees{raw.deg, raw.billionths, raw.negative}; }
+
+// Re-anchors the sample clock whenever the GPS reports a new time of day.
+void updateSampleClock(unsigned long now) {
+  if (!gps.time.isValid() || !gps.date.isValid()) return;
+  uint32_t v = gps.time.value();
+  if (gpsClockValid && v == gpsClockValue) return;
+  gpsClockValue = v;
+  gpsClockAnchor.days = daysSince2000(gps.date.year(), gps.date.month(), gps.date.day());
+  gpsClockAnchor.msOfDay = ((gps.time.hour() * 60UL + gps.time.minute()) * 60UL + gps.time.second()) * 1000UL
+                           + gps.time.centisecond() * 10UL;
+  gpsClockMillis = now;
+  gpsClockMicros = micros();
+  gpsClockValid = true;
+  bufferPulseSync();
+}
+
+bool sampleClockNow(SampleTime &t, unsigned long now) {
+  if (!gpsClockValid) return false;
+  t = gpsClockAnchor;
+  long elapsed = (long)(now - gpsClockMillis); // negative for a moment before the anchor
+  if (elapsed < 0 && (uint32_t)-elapsed > t.msOfDay) { t.days--; t.msOfDay += 86400000UL; }
+  t.msOfDay += elapsed;
+  while (t.msOfDay >= 86400000UL) { t.msOfDay -= 86400000UL; t.days++; }
+  return true;
+}
+
 void format12Hour(int hour24, int &hour12, const char* &amPm) {
   if (hour24 == 0) { hour12 = 12; amPm = "AM"; }
   else if (hour24 < 12) { hour12 = hour24; amPm = "AM"; }
@@ -154,89 +690,1480 @@ void format12Hour(int hour24, int &hour12, const char* &amPm) {
 }
 
 // ==================== FILENAME (8.3 safe) ====================
+// Daily index xx: see formatLogIndex() in Log-format.h.
+// Next free index per date, filled by the directory walk in scanLogFiles()
+// and bumped on every allocation. When more dates exist than slots, the oldest
+// are dropped and anything at or below logNameFloor falls back to probing.
+void noteLogName(uint32_t date, int index) {
+  LogNameSlot *oldest = NULL;
+  for (uint8_t i = 0; i < logNameCount; ++i) {
+    LogNameSlot &slot = logNameCache[i];
+    if (slot.date == date) { if (index >= slot.next) slot.next = index + 1; return; }
+    if (!oldest || slot.date < oldest->date) oldest = &slot;
+  }
+  if (logNameCount < LOG_NAME_CACHE_SIZE) oldest = &logNameCache[logNameCount++];
+  else if (date < oldest->date) { if ((long)date > logNameFloor) logNameFloor = date; return; }
+  else if ((long)oldest->date > logNameFloor) logNameFloor = oldest->date;
+  oldest->date = date;
+  oldest->next = index + 1;
+}
+
 void generateNextAvailableLogFileName(char *outFilename, size_t outSize, int yy, int mm, int dd) {
-  for (int i = 0; i < 100; ++i) {
-    snprintf(outFilename, outSize, "/L%02d%02d%02d%02d.CSV", yy, mm, dd, i);
-    if (!SD.exists(outFilename)) return;
+  uint32_t date = ((uint32_t)yy * 100 + mm) * 100 + dd;
+  int index = 0;
+  bool cached = logNamesScanned && (long)date > logNameFloor;
+  if (cached) {
+    for (uint8_t i = 0; i < logNameCount; ++i) if (logNameCache[i].date == date) index = logNameCache[i].next;
   }
-  snprintf(outFilename, outSize, "/L%02d%02d%02d99.CSV", yy, mm, dd);
+  if (index > LOG_INDEX_MAX) index = LOG_INDEX_MAX; // reuse the last name, as the 99 cap did
+  snprintf(outFilename, outSize, "/L%02d%02d%02dxx." LOG_FILE_EXT, yy, mm, dd);
+  formatLogIndex(outFilename + 8, index);
+  // No scan yet, or a date the cache dropped: probe like before
+  while (!cached && index < LOG_INDEX_MAX && SD.exists(outFilename)) formatLogIndex(outFilename + 8, ++index);
+  noteLogName(date, index);
 }
 
-bool openLogFileNew() {
-  if (!sdInserted) return false;
-  int yy = gps.date.isValid() ? gps.date.year() % 100 : 0;
-  int mm = gps.date.isValid() ? gps.date.month() : 0;
-  int dd = gps.date.isValid() ? gps.date.day() : 0;
+// ==================== PRE-ALLOCATION ====================
+// Seeking past EOF on a file open for writing makes FatFs extend the cluster
+// chain in one go (contiguous while free space is), so later appends only
+// overwrite already-owned sectors. The real length is restored on close.
+void preallocateLogFile(LogStream &s, size_t bytes) {
+  if (bytes <= s.dataEnd) return;
+  if (s.file.seek(bytes - 1)) s.file.write((uint8_t)0); // committed by the caller's sync
+  s.file.seek(s.dataEnd);
+}
+
+bool truncateLogFile(const char *path, size_t len) {
+  String vfsPath = String(SD_MOUNT_POINT) + path;
+  return truncate(vfsPath.c_str(), len) == 0;
+}
+
+// Whether a line past the header of a CSV log written before block journaling
+// is a sample. Unwritten pre-allocated space holds whatever the card had there.
+bool logLineLooksValid(const uint8_t *line) {
+  int nl = -1;
+  for (int i = 0; i < LOG_LINE_SIZE; ++i) {
+    char c = line[i];
+    if (nl >= 0) { if (c != ' ') return false; }
+    else if (c == '\n') nl = i;
+    else if (!strchr("0123456789.,-: ", c)) return false;
+  }
+  return nl > 0;
+}
+
+// Valid data in a log: header plus the leading run of intact blocks, or of
+// plausible records where blocks carry no crc. checked tells which, since
+// only a crc-backed end is safe to cut a full-size file at.
+struct LogDataScan {
+  size_t end;           // cut the file here
+  uint32_t records;     // samples before end; frames for LOG_COMPRESS
+  bool checked;
+  uint32_t nextSeq;     // journaled CSV: block number to continue with
+  uint32_t salt;        // journaled CSV: the file's salt
+};
+
+#if LOG_COMPRESS
+LogDataScan findLogDataEnd(File &f) {
+  LogFileHeader hdr;
+  LogDataScan scan = {sizeof(hdr), 0, false, 0, 0};
+  LogBlockFrame fr;
+  uint8_t buf[LOG_SECTOR_SIZE];
+  if (f.read((uint8_t*)&hdr, sizeof(hdr)) != sizeof(hdr) || memcmp(hdr.magic, LOG_LZ_MAGIC, 4) != 0) {
+    scan.end = 0;
+    return scan;
+  }
+  for (uint8_t seq = 0; f.read((uint8_t*)&fr, sizeof(fr)) == sizeof(fr); ++seq) {
+    if (fr.sync != LOG_FRAME_SYNC || fr.seq != seq) break;
+    uint32_t crc = crc32Update(hdr.salt, &fr, offsetof(LogBlockFrame, crc));
+    size_t left = fr.storedLen, n;
+    while (left > 0 && (n = f.read(buf, left < sizeof(buf) ? left : sizeof(buf))) > 0) {
+      crc = crc32Update(crc, buf, n);
+      left -= n;
+    }
+    if (left > 0 || crc != fr.crc) break;
+    scan.end += sizeof(fr) + fr.storedLen;
+    scan.records++;
+    scan.checked = true;
+  }
+  return scan;
+}
+#elif LOG_FORMAT == LOG_FORMAT_DELTA
+LogDataScan findLogDataEnd(File &f) {
+  LogDeltaScan ds(LOG_SAMPLE_PERIOD_MS);
+  uint8_t buf[LOG_SECTOR_SIZE];
+  size_t n;
+  f.seek(sizeof(LogFileHeader));
+  while (!ds.done && (n = f.read(buf, sizeof(buf))) > 0) logDeltaScanFeed(ds, buf, n);
+  logDeltaScanEnd(ds);
+  return LogDataScan{sizeof(LogFileHeader) + ds.end, ds.times.records, false, 0, 0};
+}
+#else
+LogDataScan findLogDataEnd(File &f) {
+  LogDataScan scan = {0, 0, false, 0, 0};
+  size_t &pos = scan.end;
+  uint8_t rec[LOG_RECORD_SIZE];
+#if LOG_FORMAT == LOG_FORMAT_BINARY
+  // Records count while their times follow on, so an older log's records in
+  // the pre-allocated tail are not taken for this file's
+  LogRecordScan rs;
+  pos = sizeof(LogFileHeader);
+  f.seek(pos);
+  while (f.read(rec, sizeof(rec)) == sizeof(rec) && logRecordScanNext(rs, rec)) pos += sizeof(rec);
+  scan.records = rs.records;
+#else
+  LogJournalScan j;
+  uint8_t buf[LOG_SECTOR_SIZE];
+  size_t n;
+  while (!j.done && (n = f.read(buf, sizeof(buf))) > 0) logJournalFeed(j, buf, n);
+  if (j.blocks > 0) return LogDataScan{j.end, j.records, true, j.blocks, j.salt};
+
+  // Written before block journaling: keep the plausible lines
+  f.seek(0);
+  int c;
+  while ((c = f.read()) >= 0) { pos++; if (c == '\n') break; }
+  f.seek(pos);
+  while (f.read(rec, sizeof(rec)) == sizeof(rec) && logLineLooksValid(rec)) {
+    pos += sizeof(rec);
+    scan.records++;
+  }
+#endif
+  return scan;
+}
+#endif
+
+#if LOG_TRACK_BLOCKS == LOG_BLOCKS_JOURNAL
+// Whether a CSV log ends with a block matching its trailer, as every cleanly
+// closed one does; saves reading a whole long log at each boot.
+bool logEndsWithIntactBlock(File &f) {
+  size_t size = f.size();
+  char line[LOG_JOURNAL_LINE_SIZE];
+  uint32_t seq, bytes, salt, crc;
+  if (size < sizeof(line) || !f.seek(size - sizeof(line)) || f.read((uint8_t*)line, sizeof(line)) != sizeof(line) ||
+      !parseJournalLine(line, seq, bytes, salt, crc) || bytes > size - sizeof(line)) return false;
+
+  uint8_t buf[LOG_SECTOR_SIZE];
+  uint32_t got = 0;
+  size_t left = bytes, n;
+  f.seek(size - sizeof(line) - bytes);
+  while (left > 0 && (n = f.read(buf, left < sizeof(buf) ? left : sizeof(buf))) > 0) {
+    got = crc32Update(got, buf, n);
+    left -= n;
+  }
+  f.seek(0);
+  return left == 0 && got == crc;
+}
+#endif
+
+// Cuts a log back to its intact data. A pre-allocated file is always cut;
+// any other only at a crc-checked end, so old logs are never shortened. A
+// pre-allocated one without a sample is a prepared log that was never
+// started: it goes, with its pulse log.
+void recoverLogFile(File &f, bool preallocated) {
+  String path = f.path();
+  size_t size = f.size();
+  LogDataScan scan = findLogDataEnd(f);
+  f.close();
+  if (preallocated && scan.records == 0) {
+    SD.remove(path.c_str());
+    String pulse = path.substring(0, path.length() - 3) + "BIN";
+    pulse.setCharAt(1, 'R');
+    SD.remove(pulse.c_str());
+    Serial.printf("Removed unused %s\n", path.c_str());
+    return;
+  }
+  if (scan.end >= size || (!preallocated && !scan.checked)) return;
+  truncateLogFile(path.c_str(), scan.end);
+  Serial.printf("Recovered %s: %u of %u bytes\n", path.c_str(), (unsigned)scan.end, (unsigned)size);
+}
+
+// One walk of the root directory after mounting: caches the next free index
+// per date for generateNextAvailableLogFileName(), trims logs left at their
+// pre-allocated size by a reset or power loss, and drops a torn last block
+// from the newest log.
+void scanLogFiles() {
+  logNameCount = 0;
+  logNameFloor = -1;
+  logNamesScanned = false;
+  File root = SD.open("/");
+  if (!root) return;
+  String newest;
+  for (File f = root.openNextFile(); f; f = root.openNextFile()) {
+    String path = f.path();
+    uint32_t date;
+    int index;
+    if (!f.isDirectory() && parseLogName(path.c_str(), date, index)) noteLogName(date, index);
+    bool isLog = !f.isDirectory() && path[1] == 'L' && path.endsWith("." LOG_FILE_EXT);
+    if (isLog && path > newest) newest = path;
+    if (isLog && LOG_PREALLOC_BYTES > 0 && f.size() == LOG_PREALLOC_BYTES) recoverLogFile(f, true);
+    else f.close();
+  }
+  root.close();
+  logNamesScanned = true;
+
+#if LOG_TRACK_BLOCKS == LOG_BLOCKS_JOURNAL
+  if (newest.length() == 0) return;
+  File f = SD.open(newest.c_str(), FILE_READ);
+  if (!f) return;
+  if (f.size() != LOG_PREALLOC_BYTES && !logEndsWithIntactBlock(f)) recoverLogFile(f, false);
+  else f.close();
+#endif
+}
+
+#if LOG_FORMAT == LOG_FORMAT_CSV
+// One LOG_LINE_SIZE line, space padded; line needs formatLogLine()'s 80 bytes.
+void formatPaddedLogLine(char *line, const LogLineFields &f) {
+  int len = formatLogLine(line, f);
+  if (len > LOG_LINE_SIZE) { len = LOG_LINE_SIZE; line[LOG_LINE_SIZE-1] = '\n'; }
+  for (int i=len;i<(int)LOG_LINE_SIZE;++i) line[i]=' ';
+}
+#endif
+
+// ==================== SD LATENCY ====================
+// Log2 histograms of SD operation times (LOG_LAT_*): since boot for the "lat"
+// command, and since the last health record for the log. Times come from
+// micros() rather than the CPU cycle counter: at 160 MHz that wraps every
+// 27 s, inside the longest mounts and retried writes, and 1 us is finer than
+// any bucket needs. latencyMux keeps the update short enough that loop()
+// never waits on a writer holding the card.
+void noteLatency(uint8_t kind, uint32_t us) {
+  uint8_t k = logLatencyBucket(us);
+  LatencyHist *hists[] = {&sdLatency[kind], &sdLatencyWindow[kind]};
+  portENTER_CRITICAL(&latencyMux);
+  for (LatencyHist *h : hists) {
+    h->counts[k]++;
+    h->total++;
+    if (us > h->maxMicros) h->maxMicros = us;
+  }
+  portEXIT_CRITICAL(&latencyMux);
+}
+
+// Bucket holding the permille-th percentile
+uint8_t latencyPercentile(const LatencyHist &h, uint32_t permille) {
+  uint32_t need = (uint32_t)(((uint64_t)h.total * permille + 999) / 1000), seen = 0;
+  for (uint8_t k = 0; k < LOG_LAT_BUCKETS; ++k)
+    if ((seen += h.counts[k]) >= need) return k;
+  return LOG_LAT_BUCKETS - 1;
+}
+
+void printLatency() {
+  LatencyHist hists[LOG_LAT_KINDS];
+  portENTER_CRITICAL(&latencyMux);
+  memcpy(hists, sdLatency, sizeof(hists));
+  portEXIT_CRITICAL(&latencyMux);
+  Serial.println("SD latency since boot, us:  count      p50      p99      max");
+  for (uint8_t i = 0; i < LOG_LAT_KINDS; ++i) {
+    const LatencyHist &h = hists[i];
+    if (h.total == 0) continue;
+    Serial.printf("  %-8s %8lu %8lu %8lu %8lu\n", logLatencyName(i), (unsigned long)h.total,
+                  (unsigned long)logLatencyBucketMicros(latencyPercentile(h, 500)),
+                  (unsigned long)logLatencyBucketMicros(latencyPercentile(h, 990)), (unsigned long)h.maxMicros);
+  }
+}
+
+// Loop side: every LOG_HEALTH_SECONDS, one LOG_EVENT_LATENCY per kind that
+// ran, queued like markers so a busy buffer delays them instead of losing them
+void checkHealthRecord(unsigned long now) {
+  if (LOG_HEALTH_SECONDS == 0 || now - lastHealthMillis < LOG_HEALTH_SECONDS * 1000UL) return;
+  lastHealthMillis = now;
+  LatencyHist window[LOG_LAT_KINDS];
+  portENTER_CRITICAL(&latencyMux);
+  memcpy(window, sdLatencyWindow, sizeof(window));
+  memset(sdLatencyWindow, 0, sizeof(sdLatencyWindow));
+  portEXIT_CRITICAL(&latencyMux);
+  LogRecord at = eventStamp();
+  for (uint8_t i = 0; i < LOG_LAT_KINDS; ++i) {
+    const LatencyHist &h = window[i];
+    if (h.total == 0) continue;
+    // clamped so the CSV line fits LOG_JOURNAL_LINE_SIZE
+    queueTrackEvent(logEventAt(LOG_EVENT_LATENCY, h.total > 99999 ? 99999 : h.total,
+                                h.maxMicros > 9999999 ? 9999999 : h.maxMicros,
+                                logLatencyTag(i, latencyPercentile(h, 500), latencyPercentile(h, 990)), at));
+  }
+}
+
+// SD.open() for log files, timed.
+File openTimed(const char *path, const char *mode) {
+  uint32_t t0 = micros();
+  File f = SD.open(path, mode);
+  noteLatency(LOG_LAT_OPEN, micros() - t0);
+  return f;
+}
+
+// ==================== RETAINED RING ====================
+#if RETAINED_RECORDS
+void beginRetainedLog(const char *name) {
+  retained.magic = 0;
+  strncpy(retained.fileName, name, sizeof(retained.fileName) - 1);
+  retained.fileName[sizeof(retained.fileName) - 1] = 0;
+  retained.nameCrc = crc32Update(0, retained.fileName, strlen(retained.fileName));
+  retained.size = sizeof(retained);
+  retained.head = 0;
+  retained.first = 0;
+  retained.end = RETAINED_OPEN;
+  std::atomic_signal_fence(std::memory_order_release);
+  retained.magic = RETAINED_MAGIC;
+}
+
+// Writer side, once a rollover reached the card: the ring now belongs to the
+// next log, from the sample loop() marked as the old log's end. Until then a
+// reset restores the old log's samples, which may still be queued.
+void continueRetainedLog(const char *name) {
+  retained.magic = 0;
+  std::atomic_signal_fence(std::memory_order_release);
+  strncpy(retained.fileName, name, sizeof(retained.fileName) - 1);
+  retained.fileName[sizeof(retained.fileName) - 1] = 0;
+  retained.nameCrc = crc32Update(0, retained.fileName, strlen(retained.fileName));
+  retained.first = retained.end;
+  retained.end = RETAINED_OPEN;
+  std::atomic_signal_fence(std::memory_order_release);
+  retained.magic = RETAINED_MAGIC;
+}
 
+void retainRecord(const LogRecord &rec) {
+  retained.ring[retained.head % RETAINED_RECORDS] = rec;
+  std::atomic_signal_fence(std::memory_order_release); // a reset in between must not expose a stale slot
+  retained.head++;
+}
+
+// Appends the samples a reset kept from reaching the card to the log they were
+// buffered for. The log's intact records are counted so nothing is written twice.
+void restoreRetainedLog() {
+  if (esp_reset_reason() == ESP_RST_POWERON || retained.magic != RETAINED_MAGIC) return;
+  retained.magic = 0;
+  retained.fileName[sizeof(retained.fileName) - 1] = 0;
+  if (retained.size != sizeof(retained) ||
+      retained.nameCrc != crc32Update(0, retained.fileName, strlen(retained.fileName))) return;
+
+  File f = openTimed(retained.fileName, "r+");
+  if (!f) return;
+  LogDataScan scan = findLogDataEnd(f);
+  uint32_t head = retained.head < retained.end ? retained.head : retained.end;
+  uint32_t from = retained.first + scan.records;
+  if (retained.head > RETAINED_RECORDS && retained.head - RETAINED_RECORDS > from) from = retained.head - RETAINED_RECORDS;
+  if (from >= head || (LOG_TRACK_BLOCKS == LOG_BLOCKS_JOURNAL && !scan.checked) || !f.seek(scan.end)) {
+    f.close();
+    return;
+  }
+
+#if LOG_FORMAT == LOG_FORMAT_CSV
+  uint32_t crc = 0;
+  for (uint32_t i = from; i != head; ++i) {
+    char line[80];
+    LogLineFields fields;
+    logLineFieldsFromRecord(fields, retained.ring[i % RETAINED_RECORDS], LOG_RATE_HZ > 1);
+    formatPaddedLogLine(line, fields);
+    f.write((const uint8_t*)line, LOG_LINE_SIZE);
+    crc = crc32Update(crc, line, LOG_LINE_SIZE);
+  }
+  char trailer[LOG_JOURNAL_LINE_SIZE];
+  formatJournalLine(trailer, scan.nextSeq, (head - from) * LOG_LINE_SIZE, scan.salt, crc);
+  f.write((const uint8_t*)trailer, sizeof(trailer));
+#elif LOG_FORMAT == LOG_FORMAT_DELTA
+  LogRecord prev = {};
+  for (uint32_t i = from; i != head; ++i) {
+    uint8_t rec[LOG_DELTA_MAX_BYTES];
+    const LogRecord &cur = retained.ring[i % RETAINED_RECORDS];
+    f.write(rec, encodeLogDelta(rec, prev, cur, LOG_SAMPLE_PERIOD_MS, i == from)); // keyframe first
+    prev = cur;
+  }
+#else
+  for (uint32_t i = from; i != head; ++i) f.write((const uint8_t*)&retained.ring[i % RETAINED_RECORDS], sizeof(LogRecord));
+#endif
+  size_t end = f.position();
+  f.close();
+  truncateLogFile(retained.fileName, end);
+  Serial.printf("Restored %lu samples to %s\n", (unsigned long)(head - from), retained.fileName);
+}
+#else
+void beginRetainedLog(const char *) {}
+void continueRetainedLog(const char *) {}
+void restoreRetainedLog() {}
+#endif
+
+// ==================== LOG FILES ====================
+// Points a stream at a newly created file and resets its writer-side state; sdMutex held.
+void adoptLogStreamFile(LogStream &s, const String &name, File file) {
+  s.fileName = name;
+  s.file = file;
+  s.sectorTailLen = 0;
+  s.dataEnd = 0;
+  s.journalSeq = 0;
+  s.journalSalt = esp_random();
+  s.lastSyncMillis = millis();
+}
+
+bool createLogStreamFile(LogStream &s, const String &name) {
+  adoptLogStreamFile(s, name, openTimed(name.c_str(), FILE_WRITE));
+  return (bool)s.file;
+}
+
+// Column line (CSV) or LogFileHeader (binary, delta) that starts every track;
+// out needs LOG_LINE_SIZE bytes. The column line is space padded after its
+// "\r\n" like a sample line, so every line after it starts 64-byte aligned.
+size_t trackHeader(uint8_t *out) {
+#if LOG_FORMAT != LOG_FORMAT_CSV
+  LogFileHeader hdr = {};
+#if LOG_FORMAT == LOG_FORMAT_DELTA
+  memcpy(hdr.magic, LOG_DELTA_MAGIC, sizeof(hdr.magic));
+  hdr.version = LOG_DELTA_VERSION;
+#else
+  memcpy(hdr.magic, LOG_BIN_MAGIC, sizeof(hdr.magic));
+  hdr.version = LOG_BIN_VERSION;
+#endif
+  hdr.recordSize = sizeof(LogRecord);
+  hdr.rateHz = LOG_RATE_HZ;
+  memcpy(out, &hdr, sizeof(hdr));
+  return sizeof(hdr);
+#else
+  const char hdr[] = "lat,lon,speed_mph,UTC_datetime,RPM\r\n";
+  memcpy(out, hdr, sizeof(hdr) - 1);
+  memset(out + sizeof(hdr) - 1, ' ', LOG_LINE_SIZE - (sizeof(hdr) - 1));
+  return LOG_LINE_SIZE;
+#endif
+}
+
+// Writes the headers of a just-created track file, then pre-allocates and
+// syncs it; sdMutex held. Compressed files get the inner header in their first
+// frame instead, from appendTrackHeader().
+void writeTrackHeaders() {
+#if LOG_SEEK_INDEX
+  seekIndexCount = 0;
+  seekIndexStride = 1;
+  seekIndexBlocks = 0;
+#endif
+#if LOG_COMPRESS
+  LogFileHeader lzHdr = {};
+  memcpy(lzHdr.magic, LOG_LZ_MAGIC, sizeof(lzHdr.magic));
+  lzHdr.version = LOG_LZ_VERSION;
+  lzHdr.rateHz = LOG_RATE_HZ;
+  lzHdr.salt = gpsLog.journalSalt;
+  gpsLog.file.write((const uint8_t*)&lzHdr, sizeof(lzHdr));
+#endif
+  gpsLog.dataEnd = gpsLog.file.position();
+  if (gpsLog.blocks != LOG_BLOCKS_PACKED) {
+    uint8_t hdr[LOG_LINE_SIZE];
+    size_t hdrLen = trackHeader(hdr);
+    if (gpsLog.blocks == LOG_BLOCKS_JOURNAL) appendJournalBlock(gpsLog, (const char*)hdr, hdrLen);
+    else { gpsLog.file.write(hdr, hdrLen); gpsLog.dataEnd = gpsLog.file.position(); }
+  }
+  preallocateLogFile(gpsLog, LOG_PREALLOC_BYTES);
+  syncLogStream(gpsLog);
+}
+
+// Loop side: a compressed file's first bytes through the writer are its inner header.
+void appendTrackHeader() {
+  if (gpsLog.blocks != LOG_BLOCKS_PACKED) return;
+  uint8_t hdr[LOG_LINE_SIZE];
+  appendLogBytes(gpsLog, hdr, trackHeader(hdr));
+}
+
+#if PULSE_LOG
+// /RYYMMDDxx.BIN next to /LYYMMDDxx.<ext>, same date and index
+String pulseLogName(const String &trackName) {
+  String name = trackName;
+  name.setCharAt(1, 'R');
+  return name.substring(0, name.length() - 3) + "BIN";
+}
+
+void writePulseHeader(uint32_t baseMicros) {
+  PulseFileHeader hdr = {};
+  memcpy(hdr.magic, PULSE_BIN_MAGIC, sizeof(hdr.magic));
+  hdr.version = PULSE_BIN_VERSION;
+  hdr.pulsesPerRev = PULSES_PER_REV;
+  hdr.baseMicros = baseMicros;
+  pulseLog.file.write((const uint8_t*)&hdr, sizeof(hdr));
+  pulseLog.dataEnd = pulseLog.file.position();
+  syncLogStream(pulseLog);
+}
+
+bool openPulseLogFile() {
+  if (!createLogStreamFile(pulseLog, pulseLogName(gpsLog.fileName))) return false;
+  uint32_t base = micros();
+  writePulseHeader(base);
+  pulseLogLastMicros = base;
+  return true;
+}
+#endif
+
+// YYMMDDhhmm this sketch was compiled, for the session header.
+uint32_t firmwareBuild() {
+  static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+  const char *d = __DATE__, *t = __TIME__; // "Jun 14 2025", "13:45:09"
+  char mon[4] = {d[0], d[1], d[2], 0};
+  const char *m = strstr(months, mon);
+  uint32_t month = m ? (m - months) / 3 + 1 : 0;
+  uint32_t day = (d[4] == ' ' ? 0 : d[4] - '0') * 10 + (d[5] - '0');
+  uint32_t year = (d[9] - '0') * 10 + (d[10] - '0');
+  uint32_t hour = (t[0] - '0') * 10 + (t[1] - '0'), minute = (t[3] - '0') * 10 + (t[4] - '0');
+  return (((year * 100 + month) * 100 + day) * 100 + hour) * 100 + minute;
+}
+
+// YYMMDD of the GPS date, 0 while there is none.
+uint32_t gpsDateKey() {
+  if (!gps.date.isValid()) return 0;
+  return ((uint32_t)(gps.date.year() % 100) * 100 + gps.date.month()) * 100 + gps.date.day();
+}
+
+// Creates the log files for date (YYMMDD) with their headers, pre-allocated
+// and synced; sdMutex held. Run by the writer task for a prepared log, or by
+// loop() when the click finds none. Only touches writer-side state.
+bool openLogFileNew(uint32_t date) {
+  if (!sdInserted) return false;
   char fn[20];
-  generateNextAvailableLogFileName(fn, sizeof(fn), yy, mm, dd);
-  currentLogFileName = String(fn);
+  generateNextAvailableLogFileName(fn, sizeof(fn), date / 10000, date / 100 % 100, date % 100);
+  if (!createLogStreamFile(gpsLog, String(fn))) return false;
+  sdWriteCount = 0; sdWriteBytes = 0; sdWriteMicros = 0; sdWriteMaxMicros = 0;
+  sdSyncCount = 0; sdSyncMicros = 0; sdSyncMaxMicros = 0;
+  sdWriteRetries = 0; sdReopens = 0;
+#if LOG_COMPRESS
+  lzBlocks = 0; lzRawBytes = 0; lzPackedBytes = 0; lzMicros = 0; lzMaxMicros = 0;
+#endif
+  writeTrackHeaders();
+#if PULSE_LOG
+  if (!openPulseLogFile()) { gpsLog.file.close(); return false; }
+#endif
+  beginRetainedLog(fn);
+  return true;
+}
+
+// Resets loop-side state for a new track file and buffers its first records:
+// the inner header of a compressed file, then the session header.
+void beginTrackFile(const char *name) {
+  for (size_t i = 0; i < LOG_STREAM_COUNT; ++i) logStreams[i]->fileBytes = 0;
+  snprintf(trackFileName, sizeof(trackFileName), "%s", name);
+  trackFileStartMillis = millis();
+#if LOG_FORMAT == LOG_FORMAT_DELTA
+  deltaSinceKeyframe = 0;
+#endif
+  memset(&lossLogged, 0, sizeof(lossLogged));
+  memset(&trackStats, 0, sizeof(trackStats));
+  appendTrackHeader();
+  appendTrackEvent(logEventAt(LOG_EVENT_SESSION, firmwareBuild(), LOG_CONFIG, LOG_RATE_HZ, eventStamp()));
+}
+
+// Resets loop-side per-session state when logging actually starts.
+void startLogSession() {
+  memset(flushCounts, 0, sizeof(flushCounts));
+  flushMicros = 0; flushMaxMicros = 0; flushFillPercentSum = 0; trackDropped = 0;
+  trackOverflowTail = 0; trackOverflowCount = 0; trackOverflowPeak = 0;
+  gpsRxPeak = 0; gpsFailedChecksumStart = gps.failedChecksum();
+  pulseDropped = 0;
+  pulseDropsLogged = 0;
+  sdProbeCount = 0; sdProbeMicros = 0; sdProbeMaxMicros = 0;
+  trackMarkerCount = 0;
+  memset(markerCounts, 0, sizeof(markerCounts));
+  portENTER_CRITICAL(&latencyMux);
+  memset(sdLatencyWindow, 0, sizeof(sdLatencyWindow));
+  portEXIT_CRITICAL(&latencyMux);
+  memset(trackBufferStats, 0, sizeof(trackBufferStats));
+  lastHealthMillis = millis();
+  beginTrackFile(gpsLog.fileName.c_str()); // the writer is done with it
+}
+
+// While idle, has the writer create the next log so the click only flips
+// isLogging. Needs the GPS date, since the name carries it; a prepared file
+// whose date has passed is removed and prepared again.
+void prepareNextLogFile() {
+  uint32_t date = gpsDateKey();
+  if (isLogging || !sdInserted || !logNamesScanned || date == 0) return;
+  if (logPrepareState == LOG_PREPARE_READY && preparedDate != date) discardPreparedLog();
+  if (logPrepareState != LOG_PREPARE_NONE) return;
+  preparedDate = date;
+  logPrepareState = LOG_PREPARE_REQUESTED;
+  LogBlockRef ref = {gpsLog.id, LOG_BLOCK_PREPARE, logSwapEpoch};
+  if (xQueueSend(logFullQueue, &ref, 0) != pdTRUE) logPrepareState = LOG_PREPARE_NONE;
+}
 
-  logFile = SD.open(currentLogFileName.c_str(), FILE_WRITE);
-  if (!logFile) return false;
-  logFile.println("lat,lon,speed_mph,UTC_datetime,RPM");
-  logFile.flush();
+void discardPreparedLog() {
+  xSemaphoreTake(sdMutex, portMAX_DELAY);
+  for (size_t i = 0; i < LOG_STREAM_COUNT; ++i) {
+    LogStream &s = *logStreams[i];
+    if (s.file) s.file.close();
+    SD.remove(s.fileName.c_str());
+    s.fillBytes = 0;
+  }
+  xSemaphoreGive(sdMutex);
+#if RETAINED_RECORDS
+  retained.magic = 0;
+#endif
+  logPrepareState = LOG_PREPARE_NONE;
+}
+
+// Click: adopts the prepared log, or creates one now. Returns false on SD errors.
+bool startLogging() {
+  unsigned long t0 = micros();
+  while (logPrepareState == LOG_PREPARE_REQUESTED) vTaskDelay(1); // the writer is on it
+  uint32_t date = gpsDateKey();
+  bool prepared = logPrepareState == LOG_PREPARE_READY && preparedDate == date;
+  if (logPrepareState == LOG_PREPARE_READY && !prepared) discardPreparedLog();
+  logPrepareState = LOG_PREPARE_NONE;
+  bool opened = prepared;
+  if (!opened) {
+    xSemaphoreTake(sdMutex, portMAX_DELAY);
+    opened = openLogFileNew(date);
+    xSemaphoreGive(sdMutex);
+  }
+  if (!opened) return false;
+  startLogSession();
+  logStartOpenMicros = micros() - t0;
+  logStartPrepared = prepared;
+  logStartMillis = millis();
+  logStartPending = true;
   return true;
 }
 
-bool openLogFileIfNeeded() {
+bool openLogFileIfNeeded(LogStream &s) {
   if (!sdInserted) return false;
-  if (logFile) return true;
-  if (currentLogFileName.length() > 0) {
-    logFile = SD.open(currentLogFileName.c_str(), FILE_WRITE);
-    if (logFile) return true;
+  if (s.file) return true;
+  if (s.fileName.length() > 0 && sdSwapState == SD_SWAP_NONE) { // never the old name on a swapped-in card
+    s.file = openTimed(s.fileName.c_str(), "r+"); // FILE_WRITE would truncate
+    if (s.file && s.file.seek(s.dataEnd - s.sectorTailLen)) return true;
   }
   return false;
 }
 
 // ==================== LOG BUFFERING & FLUSH ====================
-void flushLogBuffer() {
-  if (logLinesCount == 0) return;
+// Writer-side helpers below run with sdMutex held.
+bool writeLogBytes(LogStream &s, const uint8_t *data, size_t len) {
+  unsigned long t0 = micros();
+  size_t at = s.file.position();
+  size_t wrote = s.file.write(data, len);
+  sdWriteCount++;
+
+  // Short write: release the card, back off, reopen and rewrite from at.
+  // loop() keeps buffering meanwhile, into the overflow FIFO once buffers run out.
+  for (int attempt = 0; wrote != len && attempt < LOG_WRITE_RETRIES; ++attempt) {
+    sdWriteRetries++;
+    if (s.file) s.file.close();
+    xSemaphoreGive(sdMutex);
+    vTaskDelay(pdMS_TO_TICKS(LOG_RETRY_BACKOFF_MS << attempt));
+    xSemaphoreTake(sdMutex, portMAX_DELAY);
+    if (!openLogFileIfNeeded(s) || !s.file.seek(at)) continue;
+    sdReopens++;
+    wrote = s.file.write(data, len);
+    sdWriteCount++;
+  }
+  unsigned long dt = micros() - t0;
+  sdWriteMicros += dt;
+  if (dt > sdWriteMaxMicros) sdWriteMaxMicros = dt;
+  noteLatency(LOG_LAT_WRITE, dt);
+  sdWriteBytes += wrote;
+  if (wrote == len) s.dataEnd = s.file.position();
+  return wrote == len;
+}
 
-  if (!sdInserted) { bottomMessage = "No SD card!"; bottomMessageTimestamp = millis(); return; }
-  if (!openLogFileIfNeeded()) { bottomMessage = "SD File Error"; bottomMessageTimestamp = millis(); return; }
+// Appends bytes so that every write ends on a sector boundary of the file;
+// whatever does not fill a sector is collected in sectorTail.
+bool appendLogSectors(LogStream &s, const void *data, size_t len) {
+  const uint8_t *p = (const uint8_t*)data;
+  size_t toBoundary = LOG_SECTOR_SIZE - (s.file.position() % LOG_SECTOR_SIZE);
+
+  if (s.sectorTailLen + len < toBoundary) {
+    memcpy(s.sectorTail + s.sectorTailLen, p, len);
+    s.sectorTailLen += len;
+    s.dataEnd += len;
+    return true;
+  }
+  if (s.sectorTailLen > 0 || toBoundary < LOG_SECTOR_SIZE) {
+    size_t take = toBoundary - s.sectorTailLen;
+    memcpy(s.sectorTail + s.sectorTailLen, p, take);
+    s.sectorTailLen = 0;
+    if (!writeLogBytes(s, s.sectorTail, toBoundary)) return false;
+    p += take; len -= take;
+  }
+  size_t whole = len - len % LOG_SECTOR_SIZE;
+  if (whole > 0 && !writeLogBytes(s, p, whole)) return false;
+  memcpy(s.sectorTail, p + whole, len - whole);
+  s.sectorTailLen = len - whole;
+  s.dataEnd = s.file.position() + s.sectorTailLen;
+  return true;
+}
 
-  size_t bytesToWrite = logLinesCount * LOG_LINE_SIZE;
-  size_t wrote = logFile.write((const uint8_t*)logBuffer, bytesToWrite);
+// Commits the stream's FatFs buffer and directory entry (or closes the file).
+void syncLogStream(LogStream &s, bool close) {
+  if (!s.file) return;
+  unsigned long t0 = micros();
+  if (close) s.file.close();
+  else s.file.flush();
+  unsigned long dt = micros() - t0;
+  sdSyncCount++;
+  sdSyncMicros += dt;
+  if (dt > sdSyncMaxMicros) sdSyncMaxMicros = dt;
+  noteLatency(LOG_LAT_SYNC, dt);
+  s.lastSyncMillis = millis();
+}
 
-  if (wrote != bytesToWrite) {
-    if (logFile) logFile.close();
-    if (openLogFileIfNeeded()) logFile.write((const uint8_t*)logBuffer, bytesToWrite);
-    else { isLogging = false; bottomMessage = "SD Write Error"; bottomMessageTimestamp = millis(); }
+bool logSyncDue(const LogStream &s) {
+  switch (LOG_SYNC_POLICY) {
+    case LOG_SYNC_EVERY_BLOCK: return true;
+    case LOG_SYNC_INTERVAL: return millis() - s.lastSyncMillis >= LOG_SYNC_INTERVAL_SECONDS * 1000UL;
+    default: return false;
+  }
+}
+
+// Appends a block, then "#P" pad lines and the journal trailer, which end it
+// on a sector boundary: the whole block reaches the card with this call and no
+// sector of it is written twice. Blocks are whole lines, so the pads fit.
+bool appendJournalBlock(LogStream &s, const char *data, size_t len) {
+  if (!appendLogSectors(s, data, len)) return false;
+  char line[LOG_JOURNAL_LINE_SIZE];
+  uint32_t crc = crc32Update(0, data, len);
+  size_t end = s.dataEnd + sizeof(line);
+  for (size_t pads = (LOG_SECTOR_SIZE - end % LOG_SECTOR_SIZE) % LOG_SECTOR_SIZE / sizeof(line); pads > 0; --pads) {
+    formatJournalPadLine(line);
+    if (!appendLogSectors(s, line, sizeof(line))) return false;
+    crc = crc32Update(crc, line, sizeof(line));
+    len += sizeof(line);
+  }
+  formatJournalLine(line, s.journalSeq++, len, s.journalSalt, crc);
+  return appendLogSectors(s, line, sizeof(line));
+}
+
+// Writes a block. A journaled one ends on a sector boundary; other streams
+// keep their partial last sector in RAM, and put it on the card only for a
+// sync, from where the next block rewrites that sector whole. Once synced, a
+// power cut loses at most the block being written (with pre-allocation, the
+// one before it too when unsynced).
+bool writeLogBlock(LogStream &s, const char *data, size_t len) {
+  if (!openLogFileIfNeeded(s)) return false;
+  static uint8_t tail[LOG_SECTOR_SIZE]; // writer only
+  size_t start = s.dataEnd, tailLen = s.sectorTailLen;
+  uint32_t seq = s.journalSeq;
+  memcpy(tail, s.sectorTail, tailLen);
+  if (!(s.blocks == LOG_BLOCKS_JOURNAL ? appendJournalBlock(s, data, len) : appendLogSectors(s, data, len))) {
+    // None of a failed block counts as written, even the part that only
+    // reached sectorTail: close truncates the file at the block's start, and
+    // a retry writes over the same bytes
+    memcpy(s.sectorTail, tail, tailLen);
+    s.sectorTailLen = tailLen;
+    s.dataEnd = start;
+    s.journalSeq = seq;
+    if (s.file) s.file.seek(start - tailLen);
+    return false;
+  }
+  if (!logSyncDue(s)) return true;
+  if (s.sectorTailLen > 0) {
+    bool wrote = writeLogBytes(s, s.sectorTail, s.sectorTailLen);
+    if (s.file) s.file.seek(s.dataEnd - s.sectorTailLen);
+    if (!wrote) return false;
+  }
+  syncLogStream(s);
+  return true;
+}
+
+// Puts the partial last sector on the card; if it does not get there, the
+// file ends before it.
+bool writeLogTail(LogStream &s) {
+  size_t len = s.sectorTailLen;
+  if (len == 0) return true;
+  bool wrote = openLogFileIfNeeded(s) && s.file.seek(s.dataEnd - len) && writeLogBytes(s, s.sectorTail, len);
+  if (!wrote) s.dataEnd -= len;
+  s.sectorTailLen = 0;
+  return wrote;
+}
+
+#if LOG_SEEK_INDEX
+// Adds a written track block to the index, thinning it when full.
+void noteSeekIndex(uint32_t time, size_t offset) {
+  if (seekIndexBlocks++ % seekIndexStride != 0) return;
+  if (seekIndexCount == LOG_SEEK_INDEX_ENTRIES) {
+    for (uint16_t i = 0; i < LOG_SEEK_INDEX_ENTRIES / 2; ++i) seekIndex[i] = seekIndex[2 * i];
+    seekIndexCount = LOG_SEEK_INDEX_ENTRIES / 2;
+    seekIndexStride *= 2;
+    if ((seekIndexBlocks - 1) % seekIndexStride != 0) return;
+  }
+  seekIndex[seekIndexCount++] = {time, (uint32_t)offset};
+}
+
+// Appends the index and its footer after the track data.
+bool writeSeekIndex() {
+  if (!openLogFileIfNeeded(gpsLog)) return false;
+  LogIndexFooter footer;
+  memcpy(footer.magic, LOG_INDEX_MAGIC, sizeof(footer.magic));
+  footer.count = seekIndexCount;
+  footer.dataEnd = gpsLog.dataEnd;
+  footer.crc = crc32Update(0, seekIndex, seekIndexCount * sizeof(LogIndexEntry));
+  if (seekIndexCount > 0 && !writeLogBytes(gpsLog, (const uint8_t*)seekIndex, seekIndexCount * sizeof(LogIndexEntry)))
+    return false;
+  return writeLogBytes(gpsLog, (const uint8_t*)&footer, sizeof(footer));
+}
+#endif
+
+// Writes a stream's partial last sector (and the track's seek index), then
+// closes the file and trims its pre-allocated space.
+void finishLogStream(LogStream &s) {
+  writeLogTail(s);
+#if LOG_SEEK_INDEX
+  if (&s == &gpsLog) writeSeekIndex();
+#endif
+  if (s.file) {
+    syncLogStream(s, true);
+    truncateLogFile(s.fileName.c_str(), s.dataEnd);
+  }
+}
+
+// Moves a stream on to s.nextName: the new file is created before the old one
+// is finished and closed, so the blocks queued after this go straight into it.
+bool rolloverLogStream(LogStream &s) {
+  File next = openTimed(s.nextName.c_str(), FILE_WRITE);
+  if (!next) return false;
+  finishLogStream(s);
+  adoptLogStreamFile(s, s.nextName, next);
+#if PULSE_LOG
+  if (&s == &pulseLog) { writePulseHeader(pulseRolloverMicros); return true; }
+#endif
+  writeTrackHeaders();
+  return true;
+}
+
+#if LOG_COMPRESS
+// Packs a block into lzFrameBuffer; runs on the writer before it takes the bus.
+size_t packWriterBlock(const char *data, size_t len) {
+  unsigned long t0 = micros();
+  size_t packed = packLogBlock((const uint8_t*)data, len, lzFrameBuffer, lzHashTable,
+                               (uint8_t)gpsLog.journalSeq++, gpsLog.journalSalt);
+  unsigned long dt = micros() - t0;
+  lzBlocks++;
+  lzRawBytes += len;
+  lzPackedBytes += packed;
+  lzMicros += dt;
+  if (dt > lzMaxMicros) lzMaxMicros = dt;
+  return packed;
+}
+#endif
+
+void logWriterTask(void *) {
+  LogBlockRef ref;
+  for (;;) {
+    if (xQueueReceive(logFullQueue, &ref, portMAX_DELAY) != pdTRUE) continue;
+    if (sdSwapState != SD_SWAP_NONE) awaitLogSwap();
+    LogStream &s = *logStreams[ref.stream];
+    if (ref.index == LOG_BLOCK_SYNC) {
+      xSemaphoreTake(sdMutex, portMAX_DELAY);
+      syncLogStream(s);
+      xSemaphoreGive(sdMutex);
+      continue;
+    }
+    if (ref.index == LOG_BLOCK_PREPARE) {
+      xSemaphoreTake(sdMutex, portMAX_DELAY);
+      bool ok = openLogFileNew(preparedDate);
+      xSemaphoreGive(sdMutex);
+      logPrepareState = ok ? LOG_PREPARE_READY : LOG_PREPARE_FAILED;
+      continue;
+    }
+    if (ref.index == LOG_BLOCK_ROLLOVER) {
+      xSemaphoreTake(sdMutex, portMAX_DELAY);
+      bool rolled = rolloverLogStream(s);
+      if (!rolled && !sdCardGone()) logWriteFailed = true; // else the next block waits for a card
+      xSemaphoreGive(sdMutex);
+      if (rolled && &s == &gpsLog) continueRetainedLog(gpsLog.fileName.c_str());
+      if (&s == logStreams[LOG_STREAM_COUNT - 1]) logRolloverPending = false;
+      continue;
+    }
+    // Pulse deltas from before a swap do not fit the new file's base
+    bool keep = &s == &gpsLog || ref.epoch == logSwapEpoch;
+    while (keep) {
+      const char *data = s.buffers + ref.index * s.bufferSize;
+      size_t len = s.bufferBytes[ref.index];
+#if LOG_COMPRESS
+      if (s.blocks == LOG_BLOCKS_PACKED) { len = packWriterBlock(data, len); data = (const char*)lzFrameBuffer; }
+#endif
+      xSemaphoreTake(sdMutex, portMAX_DELAY);
+#if LOG_SEEK_INDEX
+      size_t blockStart = s.dataEnd;
+#endif
+      bool wrote = writeLogBlock(s, data, len);
+      if (wrote || !sdCardGone()) {
+        if (!wrote) logWriteFailed = true;
+#if LOG_SEEK_INDEX
+        if (wrote && &s == &gpsLog && trackBufferSampled[ref.index]) noteSeekIndex(trackBufferTime[ref.index], blockStart);
+#endif
+        xSemaphoreGive(sdMutex);
+        break;
+      }
+      // A track block waits for the next card; a pulse block is dropped
+      sdSwapState = SD_SWAP_OUT;
+      xSemaphoreGive(sdMutex);
+      if (&s == &gpsLog) awaitLogSwap();
+      keep = &s == &gpsLog && !logWriteFailed;
+    }
+#if LOG_SEEK_INDEX
+    if (&s == &gpsLog) trackBufferSampled[ref.index] = false;
+#endif
+    if (&s == &gpsLog) memset(&trackBufferStats[ref.index], 0, sizeof(TrackStats));
+    s.bufferBytes[ref.index] = 0;
+    xQueueSend(s.freeQueue, &ref.index, portMAX_DELAY);
+  }
+}
+
+// Buffer 0 starts as the fill buffer, the rest are free for the writer.
+void initLogStream(LogStream &s) {
+  s.freeQueue = xQueueCreate(s.bufferCount, sizeof(uint8_t));
+  for (uint8_t i = 1; i < s.bufferCount; ++i) xQueueSend(s.freeQueue, &i, 0);
+  s.fillIndex = 0;
+  s.fillBytes = 0;
+}
+
+bool logWriterIdle() {
+  for (size_t i = 0; i < LOG_STREAM_COUNT; ++i)
+    if (uxQueueMessagesWaiting(logStreams[i]->freeQueue) != logStreams[i]->bufferCount - 1u) return false;
+  return true;
+}
+
+void waitLogWriterIdle() { while (!logWriterIdle()) vTaskDelay(1); }
+
+// Opens the continuation files loop() named after a card swap and writes the
+// track preamble (header records, #C, #W) ahead of the blocks held meanwhile.
+// sdMutex held.
+bool continueLogStreams() {
+  for (size_t i = 0; i < LOG_STREAM_COUNT; ++i) {
+    LogStream &s = *logStreams[i];
+    File next = openTimed(s.nextName.c_str(), FILE_WRITE);
+    if (!next) return false;
+    adoptLogStreamFile(s, s.nextName, next);
+  }
+#if PULSE_LOG
+  writePulseHeader(pulseRolloverMicros);
+#endif
+  writeTrackHeaders();
+  const char *data = (const char*)swapPreamble;
+  size_t len = swapPreambleLen;
+#if LOG_COMPRESS
+  if (gpsLog.blocks == LOG_BLOCKS_PACKED) { len = packWriterBlock(data, len); data = (const char*)lzFrameBuffer; }
+#endif
+  return writeLogBlock(gpsLog, data, len);
+}
+
+// Writer side while the card is out: once loop() has let go of the old card,
+// probes the slot every SD_CHECK_INTERVAL_MS and mounts and scans the next
+// card, so sampling never waits on either. True once a card is mounted.
+bool findSwapCard() {
+  static unsigned long lastCheck = 0;
+  unsigned long now = millis();
+  if (sdInserted || now - lastCheck < SD_CHECK_INTERVAL_MS) return false;
+  lastCheck = now;
+  xSemaphoreTake(sdMutex, portMAX_DELAY);
+  uint32_t t0 = micros();
+  bool found = probeSDCard();
+  uint32_t dt = micros() - t0;
+  if (found) scanLogFiles(); // another card: rebuild the name cache
+  xSemaphoreGive(sdMutex);
+  sdProbeCount++;
+  sdProbeMicros += dt;
+  if (dt > sdProbeMaxMicros) sdProbeMaxMicros = dt;
+  if (found) Serial.printf("SD inserted: mounted by the writer in %lu us\n", (unsigned long)dt);
+  return found;
+}
+
+// Parks the writer while the card is out, looking for the next one, then
+// continues the session on it. A failure there ends the session like any
+// write error.
+void awaitLogSwap() {
+  while (sdSwapState == SD_SWAP_OUT) {
+    vTaskDelay(pdMS_TO_TICKS(SD_SWAP_POLL_MS));
+    if (findSwapCard()) sdSwapState = SD_SWAP_MOUNTED;
+  }
+  while (sdSwapState == SD_SWAP_MOUNTED) vTaskDelay(pdMS_TO_TICKS(SD_SWAP_POLL_MS));
+  if (sdSwapState != SD_SWAP_RESUME) return;
+  xSemaphoreTake(sdMutex, portMAX_DELAY);
+  bool ok = continueLogStreams();
+  xSemaphoreGive(sdMutex);
+  sdSwapState = SD_SWAP_NONE;
+  if (!ok) logWriteFailed = true;
+}
+
+// Hands a stream's fill buffer to the writer and swaps in a free one; never
+// waits on SD. False when the writer still holds every other buffer.
+bool flushLogStream(LogStream &s) {
+  if (s.fillBytes == 0) return true;
+  uint8_t next;
+  if (xQueueReceive(s.freeQueue, &next, 0) != pdTRUE) return false;
+
+  s.bufferBytes[s.fillIndex] = s.fillBytes;
+  LogBlockRef ref = {s.id, s.fillIndex, logSwapEpoch};
+  xQueueSend(logFullQueue, &ref, 0);
+  s.fillIndex = next;
+  s.fillBytes = 0;
+  return true;
+}
+
+// flushLogStream() with the handoff counted and timed for the close report.
+bool handOffLogStream(LogStream &s, FlushReason why) {
+  uint32_t fill = s.fillBytes * 100 / s.bufferSize;
+  unsigned long t0 = micros();
+  if (!flushLogStream(s)) return false;
+  uint32_t us = micros() - t0;
+  flushCounts[why]++;
+  flushMicros += us;
+  if (us > flushMaxMicros) flushMaxMicros = us;
+  flushFillPercentSum += fill;
+  noteLatency(LOG_LAT_HANDOFF, us);
+  return true;
+}
+
+bool appendLogBytes(LogStream &s, const void *data, size_t len) {
+  if (s.fillBytes + len > s.bufferSize && !handOffLogStream(s, FLUSH_FULL)) return false;
+  if (s.fillBytes == 0) s.fillStartMillis = millis();
+  memcpy(s.buffers + s.fillIndex * s.bufferSize + s.fillBytes, data, len);
+  s.fillBytes += len;
+  s.fileBytes += len;
+  return true;
+}
+
+// Drains the GPS UART. True once per burst, when the receiver has gone quiet:
+// the epoch is parsed and the next one is most of a second away.
+bool readGps(unsigned long now) {
+  int backlog = gpsSerial.available();
+  if (backlog > gpsRxPeak) gpsRxPeak = backlog;
+  if (backlog > 0) { lastGpsByteMillis = now; gpsBurstPending = true; }
+  while (gpsSerial.available()) gps.encode(gpsSerial.read());
+  if (!gpsBurstPending || now - lastGpsByteMillis < GPS_QUIET_MS) return false;
+  gpsBurstPending = false;
+  return true;
+}
+
+// Hands buffers to the writer when they pass the high-water mark, earlier if
+// the loop is idle after a GPS burst (so SD traffic lands between bursts), and
+// at the latest once their oldest sample is BUFFER_FLUSH_INTERVAL_MS old.
+void scheduleLogFlush(unsigned long now, bool gpsQuiet) {
+  for (size_t i = 0; i < LOG_STREAM_COUNT; ++i) {
+    LogStream &s = *logStreams[i];
+    if (s.fillBytes == 0) continue;
+    size_t fill = s.fillBytes * 100 / s.bufferSize;
+    FlushReason why;
+    if (fill >= FLUSH_HIGH_WATER_PERCENT) why = FLUSH_HIGH_WATER;
+    else if (gpsQuiet && fill >= FLUSH_IDLE_PERCENT) why = FLUSH_IDLE;
+    else if (now - s.fillStartMillis >= BUFFER_FLUSH_INTERVAL_MS) why = FLUSH_LATENCY;
+    else continue;
+    if (handOffLogStream(s, why) && &s == &gpsLog) { bottomMessage = "Writing..."; bottomMessageTimestamp = now; }
+  }
+}
+
+// Hands pending records to the writer and asks it to sync every stream after
+// them, without waiting on SD.
+void requestLogSync() {
+  for (size_t i = 0; i < LOG_STREAM_COUNT; ++i) {
+    LogStream &s = *logStreams[i];
+    flushLogStream(s);
+    LogBlockRef ref = {s.id, LOG_BLOCK_SYNC, logSwapEpoch};
+    xQueueSend(logFullQueue, &ref, 0);
+  }
+}
+
+// LOG_SYNC_LOW_VOLTAGE: syncs once each time the supply sags, while there is
+// still charge left to finish the FAT and directory writes.
+void checkSupplyVoltage() {
+  unsigned long now = millis();
+  if (LOG_SYNC_POLICY != LOG_SYNC_LOW_VOLTAGE || now - lastVoltageCheckMillis < LOW_VOLTAGE_CHECK_MS) return;
+  lastVoltageCheckMillis = now;
+  uint32_t mv = analogReadMilliVolts(VBAT_PIN) * VBAT_DIVIDER;
+  if (!lowVoltage && mv < LOW_VOLTAGE_MV) {
+    lowVoltage = true;
+    if (isLogging) requestLogSync();
+    bottomMessage = "Low battery"; bottomMessageTimestamp = now;
+  } else if (lowVoltage && mv > LOW_VOLTAGE_MV + LOW_VOLTAGE_HYSTERESIS_MV) {
+    lowVoltage = false;
+  }
+}
+
+// Flushes pending records, waits for the writer to drain and closes the files.
+void closeLogFile() {
+  // At low LOG_RATE_HZ the parked samples can outnumber the buffers, so wait
+  // for a free one for as long as the drains make progress
+  uint32_t parked;
+  do {
+    parked = trackOverflowCount + trackMarkerCount;
+    waitLogWriterIdle(); // make sure a free buffer exists for the next handoff
+    drainTrackOverflow();
+    drainTrackMarkers();
+  } while (trackOverflowCount + trackMarkerCount > 0 && trackOverflowCount + trackMarkerCount < parked);
+  waitLogWriterIdle(); // room for the loss record and footer
+  LogRecord at = eventStamp();
+  logLossCounters(at);
+  appendTrackFooter(at);
+  waitLogWriterIdle(); // the footer may have handed off a full buffer
+  for (size_t i = 0; i < LOG_STREAM_COUNT; ++i) flushLogStream(*logStreams[i]);
+  waitLogWriterIdle();
+  xSemaphoreTake(sdMutex, portMAX_DELAY);
+  for (size_t i = 0; i < LOG_STREAM_COUNT; ++i) {
+    LogStream &s = *logStreams[i];
+    finishLogStream(s);
+    s.fillBytes = 0;
+  }
+  xSemaphoreGive(sdMutex);
+#if RETAINED_RECORDS
+  retained.magic = 0; // everything is on the card
+#endif
+
+  unsigned long kbps = sdWriteMicros ? (unsigned long)((uint64_t)sdWriteBytes * 1000ULL / sdWriteMicros) : 0;
+  Serial.printf("SD: %lu writes, %lu bytes, %lu KB/s, max write %lu us\n", (unsigned long)sdWriteCount,
+                (unsigned long)sdWriteBytes, kbps, (unsigned long)sdWriteMaxMicros);
+  Serial.printf("SD: %lu syncs, %lu us in sync, max sync %lu us\n", (unsigned long)sdSyncCount,
+                (unsigned long)sdSyncMicros, (unsigned long)sdSyncMaxMicros);
+  uint32_t handoffs = 0;
+  Serial.print("Flush:");
+  for (int i = 0; i < FLUSH_REASONS; ++i) {
+    Serial.printf(" %lu %s", (unsigned long)flushCounts[i], flushReasonNames[i]);
+    handoffs += flushCounts[i];
+  }
+  if (handoffs > 0)
+    Serial.printf(", avg fill %lu%%, %lu us/handoff, max %lu us", (unsigned long)(flushFillPercentSum / handoffs),
+                  (unsigned long)(flushMicros / handoffs), (unsigned long)flushMaxMicros);
+  Serial.printf("\nOverruns: %lu samples dropped, overflow peak %u/%u, GPS UART peak %d/%d bytes, %lu bad NMEA checksums\n",
+                (unsigned long)trackDropped, (unsigned)trackOverflowPeak, (unsigned)TRACK_OVERFLOW_RECORDS,
+                gpsRxPeak, GPS_RX_BUFFER_SIZE, (unsigned long)(gps.failedChecksum() - gpsFailedChecksumStart));
+  Serial.printf("SD: %lu write retries, %lu reopens\n", (unsigned long)sdWriteRetries, (unsigned long)sdReopens);
+  if (sdProbeCount > 0)
+    Serial.printf("SD probe: %lu checks, %lu us/check, max %lu us\n", (unsigned long)sdProbeCount,
+                  (unsigned long)(sdProbeMicros / sdProbeCount), (unsigned long)sdProbeMaxMicros);
+  printLatency();
+#if LOG_COMPRESS
+  if (lzBlocks > 0)
+    Serial.printf("LZ: %lu blocks, %lu -> %lu bytes, %lu us/block, max %lu us\n", (unsigned long)lzBlocks,
+                  (unsigned long)lzRawBytes, (unsigned long)lzPackedBytes,
+                  (unsigned long)(lzMicros / lzBlocks), (unsigned long)lzMaxMicros);
+#endif
+#if PULSE_LOG
+  Serial.printf("Pulses dropped: %lu\n", (unsigned long)pulseDropped);
+#endif
+}
+
+// ==================== RAW PULSE STREAM ====================
+#if PULSE_LOG
+void appendPulseRecord(uint8_t type, const void *payload, size_t len) {
+  uint8_t rec[VARINT32_MAX_BYTES + sizeof(PulseSync)];
+  uint8_t *p = putVarint(rec, ((uint32_t)type << 1) | 1);
+  memcpy(p, payload, len);
+  if (!appendLogBytes(pulseLog, rec, p - rec + len)) pulseDropped++; // counts as a lost pulse slot
+}
+
+void bufferPulse(uint32_t t) {
+  if (!isLogging || sdSwapState != SD_SWAP_NONE) return;
+  if (pulseDropped != pulseDropsLogged) {
+    uint32_t dropped = pulseDropped;
+    appendPulseRecord(PULSE_REC_DROPS, &dropped, sizeof(dropped));
+    pulseDropsLogged = dropped;
+  }
+  uint32_t delta = t - pulseLogLastMicros;
+  bool ok;
+  if (delta >= 0x80000000UL) {
+    appendPulseRecord(PULSE_REC_PULSE_AT, &t, sizeof(t));
+    ok = true;
   } else {
-    logFile.flush();
-    logLinesCount = 0;
-    bottomMessage = "Writing...";
-    bottomMessageTimestamp = millis();
-  }
-}
-
-void bufferLogLine() {
-  char line[LOG_LINE_SIZE];
-  int speed_mph = gps.speed.isValid() ? (int)(gps.speed.mph() + 0.5) : -1;
-  int len = snprintf(line, sizeof(line),
-    "%.6f,%.6f,%d,%04d-%02d-%02d %02d:%02d:%02d,%d\n",
-    gps.location.isValid() ? gps.location.lat() : 0.0,
-    gps.location.isValid() ? gps.location.lng() : 0.0,
-    speed_mph,
-    gps.date.isValid() ? gps.date.year() : 0,
-    gps.date.isValid() ? gps.date.month() : 0,
-    gps.date.isValid() ? gps.date.day() : 0,
-    gps.time.isValid() ? gps.time.hour() : 0,
-    gps.time.isValid() ? gps.time.minute() : 0,
-    gps.time.isValid() ? gps.time.second() : 0,
-    RPM
-  );
-
-  if (len < 0) return;
-  if ((size_t)len > LOG_LINE_SIZE) { len = LOG_LINE_SIZE; line[LOG_LINE_SIZE-1] = '\n'; }
-  for (int i=len;i<(int)LOG_LINE_SIZE;++i) line[i]=' ';
+    uint8_t buf[VARINT32_MAX_BYTES];
+    ok = appendLogBytes(pulseLog, buf, putVarint(buf, delta << 1) - buf);
+  }
+  if (ok) pulseLogLastMicros = t;
+  else pulseDropped++;
+}
 
-  if (logLinesCount >= LOG_LINES_MAX) flushLogBuffer();
-  if (logLinesCount < LOG_LINES_MAX) {
-    memcpy(&logBuffer[logLinesCount*LOG_LINE_SIZE], line, LOG_LINE_SIZE);
-    logLinesCount++;
+// Ties the pulse clock to GPS UTC each time the sample clock is re-anchored.
+void bufferPulseSync() {
+  if (!isLogging || sdSwapState != SD_SWAP_NONE) return;
+  PulseSync sync = {gpsClockMicros, gpsClockAnchor.days, gpsClockAnchor.msOfDay};
+  appendPulseRecord(PULSE_REC_SYNC, &sync, sizeof(sync));
+}
+#else
+void bufferPulse(uint32_t) {}
+void bufferPulseSync() {}
+#endif
+
+void captureLogRecord(LogRecord &rec, const SampleTime &t) {
+  memset(&rec, 0, sizeof(rec));
+  if (gps.location.isValid()) {
+    rec.latE7 = rawDegreesToE7(gps.location.rawLat());
+    rec.lonE7 = rawDegreesToE7(gps.location.rawLng());
+    rec.flags |= LOG_REC_LOCATION_VALID;
+  }
+  if (gps.speed.isValid()) {
+    int mph = mphFromKnotsX100(gps.speed.value());
+    rec.speedMph = mph > 255 ? 255 : mph;
+    rec.flags |= LOG_REC_SPEED_VALID;
   }
+  rec.time = (uint32_t)(t.days * 86400UL + t.msOfDay / 1000);
+  rec.millis = t.msOfDay % 1000;
+  rec.flags |= LOG_REC_DATE_VALID | LOG_REC_TIME_VALID;
+  rec.rpm = RPM > 65535 ? 65535 : RPM;
+}
+
+#if LOG_FORMAT == LOG_FORMAT_CSV
+// Integer fields for formatLogLine(); avoids the soft-float lat()/lng()/mph() getters.
+void captureLogLineFields(LogLineFields &f, const SampleTime &t) {
+  f.locationValid = gps.location.isValid();
+  if (f.locationValid) { f.lat = toLogDegrees(gps.location.rawLat()); f.lon = toLogDegrees(gps.location.rawLng()); }
+  f.speedMph = gps.speed.isValid() ? mphFromKnotsX100(gps.speed.value()) : -1;
+  civilFromDays2000(t.days, f.year, f.month, f.day);
+  uint32_t secs = t.msOfDay / 1000;
+  f.hour = secs / 3600;
+  f.minute = (secs / 60) % 60;
+  f.second = secs % 60;
+  f.millisecond = LOG_RATE_HZ > 1 ? (int)(t.msOfDay % 1000) : -1;
+  f.rpm = RPM;
+}
+#endif
+
+// Stamp for records written between samples: the sample clock now, if running.
+LogRecord eventStamp() {
+  LogRecord at = {};
+  SampleTime t;
+  if (sampleClockNow(t, millis())) captureLogRecord(at, t);
+  return at;
+}
+
+void noteTrackStats(TrackStats &st, const LogRecord &rec) {
+  st.samples++;
+  if (rec.flags & LOG_REC_SPEED_VALID) {
+    st.speedSamples++;
+    st.speedSum += rec.speedMph;
+    if (rec.speedMph > st.maxSpeed) st.maxSpeed = rec.speedMph;
+  }
+  if (rec.rpm > st.maxRpm) st.maxRpm = rec.rpm;
+  if (!(rec.flags & LOG_REC_LOCATION_VALID)) return;
+  if (!st.located) {
+    st.located = true;
+    st.minLat = st.maxLat = rec.latE7;
+    st.minLon = st.maxLon = rec.lonE7;
+  } else {
+    st.metres += logStepMetres(st.lastLat, st.lastLon, rec.latE7, rec.lonE7);
+    if (rec.latE7 < st.minLat) st.minLat = rec.latE7;
+    if (rec.latE7 > st.maxLat) st.maxLat = rec.latE7;
+    if (rec.lonE7 < st.minLon) st.minLon = rec.lonE7;
+    if (rec.lonE7 > st.maxLon) st.maxLon = rec.lonE7;
+  }
+  st.lastLat = rec.latE7;
+  st.lastLon = rec.lonE7;
+}
+
+// Adds the samples b summarises to st, as if they followed st's; the step
+// between the two is not counted.
+void mergeTrackStats(TrackStats &st, const TrackStats &b) {
+  st.samples += b.samples;
+  st.metres += b.metres;
+  st.speedSamples += b.speedSamples;
+  st.speedSum += b.speedSum;
+  if (b.maxSpeed > st.maxSpeed) st.maxSpeed = b.maxSpeed;
+  if (b.maxRpm > st.maxRpm) st.maxRpm = b.maxRpm;
+  if (!b.located) return;
+  if (!st.located) {
+    st.located = true;
+    st.minLat = b.minLat; st.maxLat = b.maxLat;
+    st.minLon = b.minLon; st.maxLon = b.maxLon;
+  } else {
+    if (b.minLat < st.minLat) st.minLat = b.minLat;
+    if (b.maxLat > st.maxLat) st.maxLat = b.maxLat;
+    if (b.minLon < st.minLon) st.minLon = b.minLon;
+    if (b.maxLon > st.maxLon) st.maxLon = b.maxLon;
+  }
+  st.lastLat = b.lastLat;
+  st.lastLon = b.lastLon;
+}
+
+// Summary of the file so far as its last records, so tools can read it from
+// the tail instead of walking every sample.
+void appendTrackFooter(const LogRecord &at) {
+  const TrackStats &st = trackStats;
+  uint32_t meanX100 = st.speedSamples ? (uint32_t)(st.speedSum * 100 / st.speedSamples) : 0;
+  appendTrackEvent(logEventAt(LOG_EVENT_TOTALS, st.samples, (uint32_t)(st.metres + 0.5), st.maxRpm, at));
+  appendTrackEvent(logEventAt(LOG_EVENT_SPEED, st.maxSpeed, meanX100, 0, at));
+  if (!st.located) return;
+  appendTrackEvent(logEventAt(LOG_EVENT_BOUNDS, (uint32_t)st.minLat, (uint32_t)st.minLon, 0, at));
+  appendTrackEvent(logEventAt(LOG_EVENT_BOUNDS, (uint32_t)st.maxLat, (uint32_t)st.maxLon, 1, at));
+}
+
+// Encodes one sample into the track buffer; CSV lines come from fields when
+// given (full GPS precision), else from the record.
+bool appendTrackSample(const LogRecord &rec, const LogLineFields *fields = nullptr) {
+#if LOG_FORMAT != LOG_FORMAT_CSV
+  (void)fields; // packed formats carry the record's precision
+#endif
+#if LOG_FORMAT == LOG_FORMAT_BINARY
+  if (!appendLogBytes(gpsLog, &rec, sizeof(rec))) return false;
+#elif LOG_FORMAT == LOG_FORMAT_DELTA
+  // Each buffer's first sample is a keyframe, so decoding can start at any block
+  if (gpsLog.fillBytes + LOG_RECORD_SIZE > gpsLog.bufferSize && !handOffLogStream(gpsLog, FLUSH_FULL)) return false;
+  uint8_t line[LOG_RECORD_SIZE];
+  size_t len = encodeLogDelta(line, deltaPrev, rec, LOG_SAMPLE_PERIOD_MS,
+                              deltaSinceKeyframe == 0 || !trackBufferSampled[gpsLog.fillIndex]);
+  // Only advance the encoder on records that made it into a buffer, so a
+  // dropped sample never leaves the next delta pointing at it
+  if (!appendLogBytes(gpsLog, line, len)) return false;
+  deltaPrev = rec;
+  if (++deltaSinceKeyframe >= LOG_KEYFRAME_SECONDS * LOG_RATE_HZ) deltaSinceKeyframe = 0;
+#else
+  char line[80]; // formatLogLine() worst case, truncated to LOG_LINE_SIZE
+  LogLineFields fromRecord;
+  if (!fields) { logLineFieldsFromRecord(fromRecord, rec, LOG_RATE_HZ > 1); fields = &fromRecord; }
+  formatPaddedLogLine(line, *fields);
+  if (!appendLogBytes(gpsLog, line, LOG_RECORD_SIZE)) return false;
+#endif
+#if RETAINED_RECORDS
+  retainRecord(rec);
+#endif
+#if LOG_SEEK_INDEX
+  if (!trackBufferSampled[gpsLog.fillIndex]) {
+    trackBufferTime[gpsLog.fillIndex] = rec.time;
+    trackBufferSampled[gpsLog.fillIndex] = true;
+  }
+#endif
+  noteTrackStats(trackStats, rec);
+  noteTrackStats(trackBufferStats[gpsLog.fillIndex], rec);
+  return true;
+}
+
+// An event as the track format stores it, at most LOG_JOURNAL_LINE_SIZE bytes.
+size_t encodeTrackEvent(uint8_t *out, const LogEventRecord &ev) {
+#if LOG_FORMAT == LOG_FORMAT_BINARY
+  memcpy(out, &ev, sizeof(ev));
+  return sizeof(ev);
+#elif LOG_FORMAT == LOG_FORMAT_DELTA
+  return encodeLogEvent(out, ev);
+#else
+  formatLogEventLine((char*)out, ev, LOG_RATE_HZ > 1);
+  return LOG_JOURNAL_LINE_SIZE;
+#endif
+}
+
+bool appendTrackEvent(const LogEventRecord &ev) {
+  uint8_t rec[LOG_JOURNAL_LINE_SIZE];
+  return appendLogBytes(gpsLog, rec, encodeTrackEvent(rec, ev));
+}
+
+// Moves samples parked while every buffer was with the writer back in line.
+void drainTrackOverflow() {
+  while (trackOverflowCount > 0 && appendTrackSample(trackOverflow[trackOverflowTail])) {
+    trackOverflowTail = (trackOverflowTail + 1) % TRACK_OVERFLOW_RECORDS;
+    trackOverflowCount--;
+  }
+}
+
+// Writes the session's loss totals into the track whenever they change, and
+// again at the start of each file; at gives the time to stamp them with.
+void logLossCounters(const LogRecord &at) {
+  uint32_t reopens = sdReopens;
+  LogEventRecord ev = logEventAt(LOG_EVENT_LOSS, trackDropped, sdWriteRetries,
+                                 (uint16_t)(reopens > 65535 ? 65535 : reopens), at);
+  if (ev.a == lossLogged.a && ev.b == lossLogged.b && ev.c == lossLogged.c) return;
+  if (appendTrackEvent(ev)) lossLogged = ev;
+}
+
+// Moves queued events into the track while there is room.
+void drainTrackMarkers() {
+  uint8_t done = 0;
+  while (done < trackMarkerCount && appendTrackEvent(trackMarkers[done])) done++;
+  memmove(trackMarkers, trackMarkers + done, (trackMarkerCount - done) * sizeof(trackMarkers[0]));
+  trackMarkerCount -= done;
+}
+
+// Marks a moment in the track (kind LOG_MARK_*, note 0 for none), stamped with
+// the sample slot atMillis falls in. Never flushes or waits on the writer: if
+// every buffer is busy it joins the track on a later pass. Returns its number
+// in the session, or 0 if it was not logged.
+uint16_t logMarker(uint8_t kind, uint16_t note, unsigned long atMillis) {
+  SampleTime t;
+  if (!isLogging || kind < 1 || kind > LOG_MARK_KINDS || trackMarkerCount == TRACK_MARKER_QUEUE ||
+      !sampleClockNow(t, atMillis)) return 0;
+  t.msOfDay -= t.msOfDay % LOG_SAMPLE_PERIOD_MS;
+  LogRecord at;
+  captureLogRecord(at, t);
+  uint16_t n = ++markerCounts[kind];
+  queueTrackEvent(logEventAt(LOG_EVENT_MARKER, kind, n, note, at));
+  return n;
+}
+
+// Puts an event into the track behind any still queued, so events keep their
+// order; false if TRACK_MARKER_QUEUE is full.
+bool queueTrackEvent(const LogEventRecord &ev) {
+  if (trackMarkerCount == TRACK_MARKER_QUEUE) return false;
+  trackMarkers[trackMarkerCount++] = ev;
+  drainTrackMarkers();
+  return true;
+}
+
+void bufferLogLine(const SampleTime &t) {
+  LogRecord rec;
+  captureLogRecord(rec, t);
+  drainTrackOverflow();
+  drainTrackMarkers();
+  logLossCounters(rec);
+  if (trackOverflowCount == 0) {
+#if LOG_FORMAT == LOG_FORMAT_CSV
+    LogLineFields fields;
+    captureLogLineFields(fields, t);
+    if (appendTrackSample(rec, &fields)) return;
+#else
+    if (appendTrackSample(rec)) return;
+#endif
+  }
+  if (trackOverflowCount == TRACK_OVERFLOW_RECORDS) { trackDropped++; return; }
+  trackOverflow[(trackOverflowTail + trackOverflowCount) % TRACK_OVERFLOW_RECORDS] = rec;
+  if (++trackOverflowCount > trackOverflowPeak) trackOverflowPeak = trackOverflowCount;
+}
+
+// ==================== ROLLOVER ====================
+// Continues the session in the next /L... (and /R...) file. The fill buffers go
+// to the writer followed by a LOG_BLOCK_ROLLOVER, and the new file's first
+// records follow straight after, so no sample waits on the switch. False when
+// the writer cannot take it yet; loop() tries again next time round.
+bool rolloverLogFile(unsigned long now) {
+  if (logRolloverPending) return false; // nextName is the writer's until it has switched
+  drainTrackOverflow();
+  if (trackOverflowCount > 0) return false;
+  for (size_t i = 0; i < LOG_STREAM_COUNT; ++i) {
+    LogStream &s = *logStreams[i];
+    if (s.fillBytes > 0 && uxQueueMessagesWaiting(s.freeQueue) == 0) return false;
+  }
+  // The footer must not push the old file's last buffer out early
+  if (gpsLog.fillBytes + TRACK_FOOTER_BYTES > gpsLog.bufferSize) { handOffLogStream(gpsLog, FLUSH_ROLLOVER); return false; }
+  uint32_t date = gpsDateKey();
+  if (date == 0 || xSemaphoreTake(sdMutex, 0) != pdTRUE) return false; // the writer has the card
+  char fn[20];
+  generateNextAvailableLogFileName(fn, sizeof(fn), date / 10000, date / 100 % 100, date % 100);
+  xSemaphoreGive(sdMutex);
+
+  appendTrackFooter(eventStamp());
+  for (size_t i = 0; i < LOG_STREAM_COUNT; ++i) {
+    LogStream &s = *logStreams[i];
+    if (s.fillBytes > 0) handOffLogStream(s, FLUSH_ROLLOVER);
+  }
+  gpsLog.nextName = fn;
+#if PULSE_LOG
+  pulseLog.nextName = pulseLogName(gpsLog.nextName);
+  pulseRolloverMicros = micros();
+  pulseLogLastMicros = pulseRolloverMicros;
+  pulseDropped = 0;
+  pulseDropsLogged = 0;
+#endif
+#if RETAINED_RECORDS
+  retained.end = retained.head; // the writer hands the ring to fn once the old log is closed
+#endif
+  logRolloverPending = true;
+  for (size_t i = 0; i < LOG_STREAM_COUNT; ++i) {
+    LogBlockRef ref = {logStreams[i]->id, LOG_BLOCK_ROLLOVER, logSwapEpoch};
+    xQueueSend(logFullQueue, &ref, 0);
+    logStreams[i]->fileBytes = 0;
+  }
+
+  uint32_t prevDate = 0;
+  int prevIndex = 0;
+  bool continues = parseLogName(trackFileName, prevDate, prevIndex);
+  Serial.printf("Rollover: %s continues in %s\n", trackFileName, fn);
+  beginTrackFile(fn);
+  if (continues) appendTrackEvent(logEventAt(LOG_EVENT_CONTINUES, prevDate, 0, prevIndex, eventStamp()));
+  bufferPulseSync();
+  bottomMessage = String("Next: ") + (fn + 1);
+  bottomMessageTimestamp = now;
+  return true;
+}
+
+void checkLogRollover(unsigned long now) {
+  bool due = false;
+#if LOG_ROLLOVER_BYTES > 0
+  due = due || gpsLog.fileBytes >= LOG_ROLLOVER_BYTES;
+#endif
+#if LOG_ROLLOVER_MINUTES > 0
+  due = due || now - trackFileStartMillis >= LOG_ROLLOVER_MINUTES * 60000UL;
+#endif
+  if (due) rolloverLogFile(now);
 }
 
 // ==================== DISPLAY FUNCTIONS ====================
@@ -249,7 +2176,7 @@ void updateDisplayLogging() {
     display.setTextSize(1);
     display.print("File created:");
     display.setCursor(0,12);
-    display.print(currentLogFileName);
+    display.print(gpsLog.fileName);
     display.display();
     if (now - fileCreatedMsgStart >= FILE_CREATED_MSG_DURATION_MS) showFileCreatedMsg=false;
     return;
@@ -323,18 +2250,269 @@ void handleButton() {
 
 bool hasFix() { return gps.location.isValid() && gps.location.age()<3000 && gps.satellites.isValid() && gps.satellites.value()>=3; }
 
+// ==================== SD CLOCK ====================
+// Identity of the mounted card for its stored clock. The SD library does not
+// expose the CID, so a CRC of sector 0 (partition table or boot sector, with
+// the volume serial) and the capacity stand in for it; 0 if unreadable.
+uint32_t sdCardId() {
+  if (!SD.readRAW(sdSector, 0)) return 0;
+  return crc32Update(0, sdSector, sizeof(sdSector)) ^ (uint32_t)(SD.cardSize() >> 9);
+}
+
+const char *sdClockKey(uint32_t id) {
+  static char key[12];
+  snprintf(key, sizeof(key), "c%08lx", (unsigned long)id);
+  return key;
+}
+
+bool mountSDAt(uint32_t hz) {
+  SD.end();
+  uint32_t t0 = micros();
+  bool ok = SD.begin(SD_CS, SPI, hz, SD_MOUNT_POINT);
+  noteLatency(LOG_LAT_MOUNT, micros() - t0);
+  return ok;
+}
+
+// Whether the card works at the clock it is mounted at: sector 0 still reads
+// as id, and a file of pseudo-random bytes written at this clock reads back.
+bool sdClockWorks(uint32_t id) {
+  if (sdCardId() != id) return false;
+  const char *path = "/SDCLOCK.TMP";
+  File f = SD.open(path, FILE_WRITE);
+  if (!f) return false;
+  uint8_t buf[256];
+  uint32_t x = id | 1, wrote = 0, read = 0;
+  for (size_t off = 0; off < SD_CLOCK_TEST_BYTES; off += sizeof(buf)) {
+    for (size_t i = 0; i < sizeof(buf); ++i) { x ^= x << 13; x ^= x >> 17; x ^= x << 5; buf[i] = (uint8_t)x; }
+    wrote = crc32Update(wrote, buf, sizeof(buf));
+    f.write(buf, sizeof(buf));
+  }
+  f.close();
+  f = SD.open(path, FILE_READ);
+  size_t n, total = 0;
+  while (f && (n = f.read(buf, sizeof(buf))) > 0) { read = crc32Update(read, buf, n); total += n; }
+  if (f) f.close();
+  SD.remove(path);
+  return total == SD_CLOCK_TEST_BYTES && read == wrote;
+}
+
+// Steps a new card up through SD_SPI_CLOCKS until one fails sdClockWorks();
+// leaves it mounted at the last clock that passed, or returns 0.
+uint32_t negotiateSDClock(uint32_t id) {
+  uint32_t good = SD_SPI_SAFE_HZ;
+  for (uint32_t hz : sdSpiClocks) {
+    if (!mountSDAt(hz) || !sdClockWorks(id)) break;
+    good = hz;
+  }
+  Serial.printf("SD: card %08lx passed up to %lu kHz\n", (unsigned long)id, (unsigned long)(good / 1000));
+  return mountSDAt(good) ? good : 0;
+}
+
+// Mounts the card at the fastest clock it has passed. Every mount starts at
+// SD_SPI_SAFE_HZ, so probing an empty slot costs one SD.begin() and no card
+// sees a clock before it is known. A known card is then remounted at its
+// stored clock and kept there if sector 0 still reads as its id; a new card,
+// or one that no longer does, is negotiated. sdMutex held.
+bool mountSDCard() {
+  unsigned long t0 = millis();
+  if (!mountSDAt(SD_SPI_SAFE_HZ)) return false;
+  uint32_t id = sdCardId();
+  uint32_t hz = sdClockPrefs.getUInt(sdClockKey(id), 0);
+  if (hz != SD_SPI_SAFE_HZ && (!hz || !mountSDAt(hz) || sdCardId() != id)) {
+    hz = negotiateSDClock(id);
+    if (!hz) return false;
+    sdClockPrefs.putUInt(sdClockKey(id), hz);
+  }
+  sdSpiHz = hz;
+  Serial.printf("SD: mounted at %lu kHz in %lu ms\n", (unsigned long)(hz / 1000), millis() - t0);
+  return true;
+}
+
+// Sequential write speed and per-write latency at a range of block sizes, for
+// the "bench" command. Takes a few seconds; not while logging.
+void runSDBenchmark() {
+  if (isLogging || !sdInserted) { Serial.println("bench: needs a card and logging stopped"); return; }
+  const size_t sizes[] = {512, 1024, 2048, 4096, 8192, 16384};
+  uint8_t *buf = (uint8_t*)malloc(sizes[sizeof(sizes) / sizeof(sizes[0]) - 1]);
+  if (!buf) { Serial.println("bench: out of memory"); return; }
+  memset(buf, 0x5A, sizes[sizeof(sizes) / sizeof(sizes[0]) - 1]);
+  const char *path = "/SDBENCH.TMP";
+  xSemaphoreTake(sdMutex, portMAX_DELAY);
+  Serial.printf("SD bench at %lu kHz, %lu KB per size\n", (unsigned long)(sdSpiHz / 1000), SD_BENCH_BYTES / 1024);
+  for (size_t size : sizes) {
+    File f = SD.open(path, FILE_WRITE);
+    if (!f) { Serial.println("bench: cannot create file"); break; }
+    uint32_t writes = SD_BENCH_BYTES / size, maxUs = 0, t0 = micros();
+    bool ok = true;
+    for (uint32_t i = 0; i < writes && ok; ++i) {
+      uint32_t w0 = micros();
+      ok = f.write(buf, size) == size;
+      uint32_t dt = micros() - w0;
+      if (dt > maxUs) maxUs = dt;
+    }
+    f.flush();
+    uint32_t total = micros() - t0;
+    f.close();
+    SD.remove(path);
+    if (!ok) { Serial.printf("%5u B: write failed\n", (unsigned)size); break; }
+    Serial.printf("%5u B: %6.2f MB/s, %5lu us/write, max %lu us\n", (unsigned)size,
+                  (double)SD_BENCH_BYTES / total, (unsigned long)(total / writes), (unsigned long)maxUs);
+  }
+  xSemaphoreGive(sdMutex);
+  free(buf);
+}
+
+// Whether the mounted card still answers: one raw read of sector 0 (a single
+// SPI command), retried once so a glitch does not end a session. sdMutex held.
+bool sdCardAnswers() {
+  return SD.readRAW(sdSector, 0) || SD.readRAW(sdSector, 0);
+}
+
+// Whether a card is in the slot: sdCardAnswers() for a mounted one, a full
+// mount for an empty slot. The card-detect switch, when wired, answers first.
+// sdMutex held.
+bool probeSDCard() {
+#if SD_DETECT_PIN >= 0
+  if (digitalRead(SD_DETECT_PIN) != LOW) return false;
+#endif
+  return sdInserted ? sdCardAnswers() : mountSDCard();
+}
+
+// After a failed write while logging: whether that was the card leaving, so
+// the session should wait for the next one. sdMutex held.
+bool sdCardGone() {
+  return isLogging && (sdSwapState != SD_SWAP_NONE || !sdInserted || !sdCardAnswers());
+}
+
+// The card went while logging: sampling carries on into the track buffers and
+// then the overflow FIFO, and the writer holds its block (SD_SWAP_OUT).
+void beginLogSwap(unsigned long now) {
+  sdSwapState = SD_SWAP_OUT;
+  sdSwapStartMillis = now;
+  sdSwapDroppedStart = trackDropped;
+  logSwapEpoch++;
+#if PULSE_LOG
+  pulseLog.fillBytes = 0; // deltas against the old file's base
+#endif
+  LogBlockRef wake = {gpsLog.id, LOG_BLOCK_SYNC, logSwapEpoch};
+  xQueueSend(logFullQueue, &wake, 0); // the writer looks for the next card even with no block to write
+  Serial.printf("SD removed while logging %s: spooling in RAM\n", trackFileName);
+}
+
+// The writer mounted a card after a swap: names the continuation files on it
+// and hands the writer their first block, header records then #C and #W.
+// Blocks held meanwhile follow, then the spool drains as buffers free up.
+void resumeLogSwap(unsigned long now) {
+  uint32_t prevDate = 0, date = gpsDateKey();
+  int prevIndex = 0;
+  bool continues = parseLogName(trackFileName, prevDate, prevIndex);
+  if (date == 0) date = prevDate;
+  char fn[sizeof(trackFileName)];
+  xSemaphoreTake(sdMutex, portMAX_DELAY);
+  generateNextAvailableLogFileName(fn, sizeof(fn), date / 10000, date / 100 % 100, date % 100);
+  xSemaphoreGive(sdMutex);
+
+  LogRecord at = eventStamp();
+  uint32_t lost = trackDropped - sdSwapDroppedStart;
+  size_t len = 0;
+  if (gpsLog.blocks == LOG_BLOCKS_PACKED) len = trackHeader(swapPreamble);
+  len += encodeTrackEvent(swapPreamble + len, logEventAt(LOG_EVENT_SESSION, firmwareBuild(), LOG_CONFIG, LOG_RATE_HZ, at));
+  if (continues) len += encodeTrackEvent(swapPreamble + len, logEventAt(LOG_EVENT_CONTINUES, prevDate, 0, prevIndex, at));
+  len += encodeTrackEvent(swapPreamble + len, logEventAt(LOG_EVENT_SWAP, now - sdSwapStartMillis, lost, 0, at));
+  swapPreambleLen = len;
+
+  gpsLog.nextName = fn;
+#if PULSE_LOG
+  pulseLog.nextName = pulseLogName(gpsLog.nextName);
+  pulseLog.fillBytes = 0;
+  pulseRolloverMicros = micros();
+  pulseLogLastMicros = pulseRolloverMicros;
+  pulseDropped = 0;
+  pulseDropsLogged = 0;
+#endif
+  for (size_t i = 0; i < LOG_STREAM_COUNT; ++i) logStreams[i]->fileBytes = 0;
+  snprintf(trackFileName, sizeof(trackFileName), "%s", fn);
+  trackFileStartMillis = millis();
+  memset(&lossLogged, 0, sizeof(lossLogged));
+  // The footer covers what the file will hold: the buffers the writer has not
+  // written (the parked writer releases none), the fill buffer last
+  memset(&trackStats, 0, sizeof(trackStats));
+  for (uint8_t i = 0; i < LOG_BUFFER_COUNT; ++i)
+    if (i != gpsLog.fillIndex) mergeTrackStats(trackStats, trackBufferStats[i]);
+  mergeTrackStats(trackStats, trackBufferStats[gpsLog.fillIndex]);
+  beginRetainedLog(fn);
+  sdSwapState = SD_SWAP_RESUME; // the writer is parked in awaitLogSwap()
+  bufferPulseSync();
+  Serial.printf("SD swap: continuing in %s after %lu ms, %lu samples lost\n", fn,
+                (unsigned long)(now - sdSwapStartMillis), (unsigned long)lost);
+}
+
 void checkSDCardPresence() {
   unsigned long now=millis();
+  if (sdSwapState == SD_SWAP_MOUNTED) { // the writer found the next card
+    sdInserted=true;
+    lastSDCheckMillis=now;
+    resumeLogSwap(now);
+    bottomMessage="Next: "+String(trackFileName + 1); bottomMessageTimestamp=now;
+    return;
+  }
+  if (sdSwapState == SD_SWAP_OUT && !sdInserted) return; // the writer looks for it
+#if SD_DETECT_PIN >= 0
+  // Checked right after the switch settles, and at the interval as a fallback
+  bool edge = sdDetectChanged && now - sdDetectMillis >= SD_DETECT_SETTLE_MS;
+  if (!edge && now-lastSDCheckMillis<SD_CHECK_INTERVAL_MS) return;
+#else
   if (now-lastSDCheckMillis<SD_CHECK_INTERVAL_MS) return;
+#endif
+  if (xSemaphoreTake(sdMutex, 0) != pdTRUE) return; // writer is using the card, check next time
   lastSDCheckMillis=now;
-  bool currentlyInserted = SD.begin(SD_CS);
+#if SD_DETECT_PIN >= 0
+  sdDetectChanged=false;
+#endif
+  uint32_t t0 = micros();
+  bool currentlyInserted = probeSDCard();
+  uint32_t dt = micros() - t0;
+  xSemaphoreGive(sdMutex);
+  sdProbeCount++;
+  sdProbeMicros += dt;
+  if (dt > sdProbeMaxMicros) sdProbeMaxMicros = dt;
+  if (sdSwapState == SD_SWAP_OUT && sdInserted) currentlyInserted = false; // the writer lost the card: remount
+  if (currentlyInserted != sdInserted) Serial.printf("SD %s: check took %lu us\n", currentlyInserted ? "inserted" : "removed", (unsigned long)dt);
   if (currentlyInserted && !sdInserted) {
     sdInserted=true;
+    if (logPrepareState != LOG_PREPARE_REQUESTED) logPrepareState = LOG_PREPARE_NONE;
+    xSemaphoreTake(sdMutex, portMAX_DELAY);
+    scanLogFiles(); // possibly another card: rebuild the name cache
+    xSemaphoreGive(sdMutex);
     bottomMessage="SD Inserted"; bottomMessageTimestamp=now;
   } else if (!currentlyInserted && sdInserted) {
-    sdInserted=false;
+    logNamesScanned=false;
+    if (logPrepareState != LOG_PREPARE_REQUESTED) logPrepareState = LOG_PREPARE_NONE;
     bottomMessage="SD Removed"; bottomMessageTimestamp=now;
-    if (isLogging) { if (logLinesCount>0) flushLogBuffer(); if (logFile) logFile.close(); isLogging=false; }
+    if (isLogging) { beginLogSwap(now); bottomMessage="SD out: spooling"; }
+    xSemaphoreTake(sdMutex, portMAX_DELAY);
+    for (size_t i = 0; i < LOG_STREAM_COUNT; ++i) if (logStreams[i]->file) logStreams[i]->file.close(); // the log, or a prepared one
+    SD.end(); // so the next card is mounted from scratch
+    xSemaphoreGive(sdMutex);
+    sdInserted=false; // last: in a swap, the writer then probes for the next card
+  }
+}
+
+// ==================== SERIAL COMMANDS ====================
+// One word per line on the USB serial port: "bench" runs runSDBenchmark(),
+// "lat" prints the SD latency histograms.
+void handleSerialCommands() {
+  static char line[16];
+  static uint8_t len = 0;
+  while (Serial.available()) {
+    char c = Serial.read();
+    if (c != '\n' && c != '\r') { if (len < sizeof(line) - 1) line[len++] = c; continue; }
+    line[len] = 0;
+    if (len == 0) continue;
+    len = 0;
+    if (!strcmp(line, "bench")) runSDBenchmark();
+    else if (!strcmp(line, "lat")) printLatency();
+    else Serial.printf("Unknown command \"%s\"; try bench, lat\n", line);
   }
 }
 
@@ -343,11 +2521,14 @@ void setup() {
   Serial.begin(115200);
   randomSeed(analogRead(0));
   pinMode(BUTTON_PIN, INPUT_PULLUP);
+#if SD_DETECT_PIN >= 0
+  pinMode(SD_DETECT_PIN, INPUT_PULLUP);
+  attachInterrupt(digitalPinToInterrupt(SD_DETECT_PIN), sdDetectISR, CHANGE);
+#endif
 
   // Hall sensor interrupt
   pinMode(HALL_PIN, INPUT_PULLUP);
   attachInterrupt(digitalPinToInterrupt(HALL_PIN), hallISR, FALLING);
-  lastRPMSampleMillis = millis();
 
   Wire.begin(SDA_PIN,SCL_PIN);
   display.begin(0x3C,true);
@@ -359,11 +2540,20 @@ void setup() {
   display.println("Initializing...");
   display.display();
 
+  gpsSerial.setRxBufferSize(GPS_RX_BUFFER_SIZE);
   gpsSerial.begin(9600,SERIAL_8N1,GPS_RX,GPS_TX);
+
+  // Log streams and the SD writer task
+  sdMutex = xSemaphoreCreateMutex();
+  size_t totalBuffers = 0;
+  for (size_t i = 0; i < LOG_STREAM_COUNT; ++i) { initLogStream(*logStreams[i]); totalBuffers += logStreams[i]->bufferCount; }
+  logFullQueue = xQueueCreate(totalBuffers + 2 * LOG_STREAM_COUNT + 1, sizeof(LogBlockRef)); // + one sync and one rollover each, + prepare
+  xTaskCreate(logWriterTask, "logWriter", LOG_WRITER_STACK, NULL, LOG_WRITER_PRIORITY, NULL);
+
   SPI.begin(SD_CLK,SD_MISO,SD_MOSI,SD_CS);
-  if (SD.begin(SD_CS)) { sdInserted=true; bottomMessage="SD Ready"; bottomMessageTimestamp=millis(); }
+  sdClockPrefs.begin("sdclock");
+  if (mountSDCard()) { sdInserted=true; restoreRetainedLog(); scanLogFiles(); bottomMessage="SD Ready"; bottomMessageTimestamp=millis(); }
   else { sdInserted=false; bottomMessage="No SD card!"; bottomMessageTimestamp=millis(); display.clearDisplay(); display.setCursor(0,0); display.println("No SD card!"); display.display(); }
-  lastBufferFlushMillis=millis();
   isLogging=false;
   bottomMessage=""; bottomMessageTimestamp=0;
   updateDisplayLogging();
@@ -372,38 +2562,21 @@ void setup() {
 // ==================== MAIN LOOP ====================
 void loop() {
   handleButton();
+  handleSerialCommands();
   checkSDCardPresence();
 
   unsigned long now=millis();
 
-  // ==== RPM update at 10 Hz (ones digit forced to 0) ====
-  const unsigned long rpmInterval = 1000UL / RPM_UPDATE_HZ;
-  if (now - lastRPMSampleMillis >= rpmInterval) {
-    unsigned long elapsed = now - lastRPMSampleMillis;
-    lastRPMSampleMillis = now;
-
-    noInterrupts();
-    unsigned long pulses = pulseCount;
-    pulseCount = 0;
-    interrupts();
-
-    if (pulses > 0) rpmSeen = true;
-
-    float rpmRaw = (elapsed > 0) ? ((float)pulses / PULSES_PER_REV) * (60000.0f / (float)elapsed) : 0.0f;
-    int rpmInt = (int)rpmRaw;
-    RPM = (rpmInt / 10) * 10; // force ones digit to 0
-  }
+  updateRPM();
 
   if (buttonJustClicked) {
     if ((now-lastToggleMillis)>=TOGGLE_COOLDOWN_MS) {
       if (!sdInserted) { bottomMessage="No SD card!"; bottomMessageTimestamp=now; }
       else {
         if (!isLogging) {
-          if (openLogFileNew()) {
-            logFile.flush();
+          if (startLogging()) {
             isLogging=true;
-            lastLoggedSecond=-1;
-            lastBufferFlushMillis=now;
+            lastLoggedSlot=-1;
             loggingStartMillis=now;
             lastToggleMillis=now;
             showFileCreatedMsg=true;
@@ -411,11 +2584,10 @@ void loop() {
             bottomMessage=""; bottomMessageTimestamp=0;
           } else { bottomMessage="File error!"; bottomMessageTimestamp=now; }
         } else {
-          if (logLinesCount>0) flushLogBuffer();
-          if (logFile) logFile.close();
+          closeLogFile();
           isLogging=false;
           lastToggleMillis=now;
-          bottomMessage="Saved as: "+currentLogFileName;
+          bottomMessage="Saved as: "+gpsLog.fileName;
           bottomMessageTimestamp=now;
         }
       }
@@ -423,20 +2595,42 @@ void loop() {
     buttonJustClicked=false;
   }
 
-  if (buttonLongPressed) { bottomMessage="Long press"; bottomMessageTimestamp=now; buttonLongPressed=false; }
+  checkSupplyVoltage();
 
-  while (gpsSerial.available()) gps.encode(gpsSerial.read());
+  if (logWriteFailed && sdSwapState == SD_SWAP_NONE) { logWriteFailed=false; closeLogFile(); isLogging=false; bottomMessage="SD Write Error"; bottomMessageTimestamp=now; }
 
-  if (isLogging && gps.time.isValid() && gps.date.isValid() && hasFix() && sdInserted) {
-    int currentSecond=gps.time.second();
-    if (currentSecond!=lastLoggedSecond) { lastLoggedSecond=currentSecond; bufferLogLine(); }
+  if (buttonLongPressed) {
+    uint16_t lap = logMarker(LOG_MARK_LAP, 0, buttonPressStart); // the lap starts when the button went down
+    bottomMessage = lap ? "Lap " + String(lap) : "Long press";
+    bottomMessageTimestamp=now; buttonLongPressed=false;
   }
 
-  if (millis()-lastBufferFlushMillis>=BUFFER_FLUSH_INTERVAL_MS) {
-    if (logLinesCount>0 && sdInserted && isLogging) {
-      if (openLogFileIfNeeded()) flushLogBuffer();
+  bool gpsQuiet = readGps(millis());
+  updateSampleClock(millis());
+  if (gpsQuiet) prepareNextLogFile();
+
+  SampleTime sampleTime;
+  if (isLogging && hasFix() && sampleClockNow(sampleTime, millis())) { // also while the card is swapped
+    // Slots only move forward: a fix that arrives early after a late one
+    // re-anchors the clock back a little, and those slots are already logged.
+    // A step back of more than a minute is a new GPS clock, logged from there.
+    int64_t slot = (int64_t)sampleTime.days * (86400000 / LOG_SAMPLE_PERIOD_MS) + sampleTime.msOfDay / LOG_SAMPLE_PERIOD_MS;
+    if (slot > lastLoggedSlot || slot < lastLoggedSlot - (int64_t)(LOG_SCAN_MAX_GAP_MS / LOG_SAMPLE_PERIOD_MS)) {
+      lastLoggedSlot = slot;
+      bufferLogLine(sampleTime);
+    }
+    if (logStartPending) {
+      logStartPending = false;
+      Serial.printf("Start: %s file in %lu us, first sample %lu ms after the click\n",
+                    logStartPrepared ? "prepared" : "new", (unsigned long)logStartOpenMicros,
+                    (unsigned long)(millis() - logStartMillis));
     }
-    lastBufferFlushMillis=millis();
+  }
+
+  if (sdInserted && isLogging) {
+    checkLogRollover(millis());
+    checkHealthRecord(millis());
+    scheduleLogFlush(millis(), gpsQuiet);
   }
 
   if (now-lastDisplayUpdateMillis>DISPLAY_UPDATE_INTERVAL_MS) {
@@ -0,0 +1,131 @@
+/*
+  Mini Logger - Block Compression
+  - Greedy LZ77 compressor writing the LZ4 block format, one block at a time
+  - 8 KB hash table supplied by the caller, no heap, no state between blocks
+  - Bounds-checked decompressor for the host tools
+  - packLogBlock() frames a writer block as LogBlockFrame + payload (Log-format.h)
+
+  Blocks are independent so any frame can be unpacked on its own, and a torn
+  frame at the end of a file only loses that block.
+*/
+
+#ifndef MINI_LOGGER_LOG_COMPRESS_H
+#define MINI_LOGGER_LOG_COMPRESS_H
+
+#include "Log-format.h"
+
+#define LZ_HASH_LOG 12
+#define LZ_HASH_SIZE (1u << LZ_HASH_LOG)  // uint16_t entries
+#define LZ_MIN_MATCH 4
+#define LZ_MF_LIMIT 12                    // no match starts in the last 12 bytes (LZ4 rule)
+#define LZ_LAST_LITERALS 5                // and none reaches the last 5
+#define LZ_BOUND(n) ((n) + (n) / 255 + 16) // worst-case compressed size
+#define LOG_FRAME_BOUND(n) (sizeof(LogBlockFrame) + LZ_BOUND(n))
+
+// ==================== COMPRESS ====================
+inline uint32_t lzRead32(const uint8_t *p) { uint32_t v; memcpy(&v, p, 4); return v; }
+inline uint32_t lzHash(uint32_t v) { return (v * 2654435761u) >> (32 - LZ_HASH_LOG); }
+
+inline uint8_t *lzPutLength(uint8_t *op, size_t len) {
+  while (len >= 255) { *op++ = 255; len -= 255; }
+  *op++ = (uint8_t)len;
+  return op;
+}
+
+inline uint8_t *lzPutSequence(uint8_t *op, const uint8_t *lit, size_t litLen, size_t matchLen) {
+  uint8_t *token = op++;
+  *token = (uint8_t)((litLen >= 15 ? 15 : litLen) << 4 | (matchLen >= 15 ? 15 : matchLen));
+  if (litLen >= 15) op = lzPutLength(op, litLen - 15);
+  memcpy(op, lit, litLen);
+  return op + litLen;
+}
+
+// Compresses n <= 65535 bytes into dst (LZ_BOUND(n) bytes); returns the size.
+inline size_t lzCompress(const uint8_t *src, size_t n, uint8_t *dst, uint16_t *table) {
+  const uint8_t *ip = src, *anchor = src, *end = src + n;
+  uint8_t *op = dst;
+  if (n > LZ_MF_LIMIT) {
+    const uint8_t *mfLimit = end - LZ_MF_LIMIT, *matchLimit = end - LZ_LAST_LITERALS;
+    memset(table, 0, LZ_HASH_SIZE * sizeof(uint16_t));
+    while (ip < mfLimit) {
+      uint32_t h = lzHash(lzRead32(ip));
+      const uint8_t *ref = src + table[h];
+      table[h] = (uint16_t)(ip - src);
+      if (ref >= ip || lzRead32(ref) != lzRead32(ip)) { ip++; continue; }
+
+      while (ip > anchor && ref > src && ip[-1] == ref[-1]) { ip--; ref--; }
+      const uint8_t *m = ip + LZ_MIN_MATCH, *r = ref + LZ_MIN_MATCH;
+      while (m < matchLimit && *m == *r) { m++; r++; }
+
+      size_t matchLen = m - ip - LZ_MIN_MATCH;
+      op = lzPutSequence(op, anchor, ip - anchor, matchLen);
+      uint16_t offset = (uint16_t)(ip - ref);
+      *op++ = (uint8_t)offset;
+      *op++ = (uint8_t)(offset >> 8);
+      if (matchLen >= 15) op = lzPutLength(op, matchLen - 15);
+      ip = anchor = m;
+    }
+  }
+  op = lzPutSequence(op, anchor, end - anchor, 0);
+  return op - dst;
+}
+
+// ==================== DECOMPRESS ====================
+// Returns the unpacked size, or -1 when src is malformed or overruns cap.
+inline long lzDecompress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap) {
+  const uint8_t *ip = src, *end = src + n;
+  uint8_t *op = dst, *oend = dst + cap;
+  while (ip < end) {
+    uint8_t token = *ip++;
+    size_t litLen = token >> 4, b;
+    if (litLen == 15) do { if (ip >= end) return -1; b = *ip++; litLen += b; } while (b == 255);
+    if ((size_t)(end - ip) < litLen || (size_t)(oend - op) < litLen) return -1;
+    memcpy(op, ip, litLen);
+    op += litLen; ip += litLen;
+    if (ip == end) break; // the last sequence is literals only
+
+    if (end - ip < 2) return -1;
+    size_t offset = ip[0] | ip[1] << 8;
+    ip += 2;
+    if (offset == 0 || offset > (size_t)(op - dst)) return -1;
+    size_t matchLen = token & 15;
+    if (matchLen == 15) do { if (ip >= end) return -1; b = *ip++; matchLen += b; } while (b == 255);
+    matchLen += LZ_MIN_MATCH;
+    if ((size_t)(oend - op) < matchLen) return -1;
+    const uint8_t *r = op - offset; // may overlap op: copy forwards byte by byte
+    while (matchLen--) *op++ = *r++;
+  }
+  return op - dst;
+}
+
+// ==================== FRAMING ====================
+// Frames n <= 65535 bytes into out (LOG_FRAME_BOUND(n) bytes), compressed
+// unless that would not save anything; returns the frame size.
+inline size_t packLogBlock(const uint8_t *src, size_t n, uint8_t *out, uint16_t *table,
+                           uint8_t seq, uint32_t salt) {
+  LogBlockFrame f = {};
+  uint8_t *payload = out + sizeof(f);
+  f.sync = LOG_FRAME_SYNC;
+  f.rawLen = (uint16_t)n;
+  f.seq = seq;
+  size_t packed = lzCompress(src, n, payload, table);
+  if (packed < n) {
+    f.method = LOG_FRAME_LZ;
+    f.storedLen = (uint16_t)packed;
+  } else {
+    f.method = LOG_FRAME_STORED;
+    f.storedLen = (uint16_t)n;
+    memcpy(payload, src, n);
+  }
+  f.crc = logFrameCrc(f, payload, salt);
+  memcpy(out, &f, sizeof(f));
+  return sizeof(f) + f.storedLen;
+}
+
+// Checks a frame header and its payload (storedLen bytes after it).
+inline bool logFrameValid(const LogBlockFrame &f, const uint8_t *payload, uint32_t salt) {
+  return f.sync == LOG_FRAME_SYNC && f.method <= LOG_FRAME_LZ &&
+         (f.method == LOG_FRAME_LZ || f.storedLen == f.rawLen) && logFrameCrc(f, payload, salt) == f.crc;
+}
+
+#endif
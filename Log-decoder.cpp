@@ -0,0 +1,601 @@
+/*
+  Mini Logger - Host Log Decoder
+  - Converts binary /LYYMMDDxx.BIN logs (LOG_FORMAT_BINARY) back to the
+    lat,lon,speed_mph,UTC_datetime,RPM CSV the sketch writes in CSV mode
+  - Also reads delta-encoded track logs (LOG_FORMAT_DELTA, same .BIN name)
+  - Unpacks compressed logs /LYYMMDDxx.LZB (LOG_COMPRESS): CSV inside comes out
+    byte-for-byte as the device would have written it, binary inside is decoded
+  - Output lines are space-padded to 64 bytes exactly like the device CSV,
+    event records (loss counters, session header and footer) become the
+    device's "#L,...", "#S,..." etc. lines
+  - Converts raw pulse logs /RYYMMDDxx.BIN (PULSE_LOG) to one CSV line per
+    hall edge: UTC_datetime,micros,period_us,RPM
+  - -s prints only the session header and footer lines (#S, #C, #T, #V, #B);
+    for CSV and uncompressed binary logs it reads just the head and tail
+  - -t FROM TO decodes only the samples in [FROM, TO): fixed-size CSV lines
+    and binary records are binary-searched, delta and compressed logs go
+    through the seek index at their end
+
+  Build: g++ -std=c++17 -O2 -o log-decoder Log-decoder.cpp
+  Usage: log-decoder L25061400.BIN > L25061400.CSV
+         log-decoder R25061400.BIN > R25061400.CSV
+         log-decoder L25061400.LZB > L25061400.CSV
+         log-decoder -s L25061400.CSV
+         log-decoder -t "2025-06-14 13:45:00" "2025-06-14 13:47:00" L25061400.LZB
+*/
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "Log-compress.h"
+
+#define LOG_LINE_SIZE 64
+
+// -t window: only records from <= time < to (seconds since 2000) are written
+struct TimeWindow { bool active; uint32_t from, to; };
+TimeWindow window = {};
+
+bool inWindow(int64_t t) { return !window.active || (t >= window.from && t < window.to); }
+
+// End of the device CSV column line: past its '\n' and the spaces that pad
+// it to LOG_LINE_SIZE (older logs have none); 0 without a '\n'.
+size_t csvHeaderEnd(const uint8_t *p, size_t n) {
+  const uint8_t *eol = (const uint8_t*)memchr(p, '\n', n);
+  if (!eol) return 0;
+  size_t end = eol + 1 - p;
+  while (end < n && end < LOG_LINE_SIZE && p[end] == ' ') end++;
+  return end;
+}
+
+// ==================== DECODE ====================
+void writeCsvLine(FILE *out, const LogRecord &rec, bool subSecond) {
+  if (!inWindow(rec.time)) return;
+  bool locValid = rec.flags & LOG_REC_LOCATION_VALID;
+  int y = 0, mo = 0, d = 0, h = 0, mi = 0, s = 0;
+  if (rec.flags & LOG_REC_DATE_VALID) civilFromDays2000(rec.time / 86400, y, mo, d);
+  if (rec.flags & LOG_REC_TIME_VALID) {
+    uint32_t secs = rec.time % 86400;
+    h = secs / 3600; mi = (secs / 60) % 60; s = secs % 60;
+  }
+  char ms[8] = "";
+  if (subSecond) snprintf(ms, sizeof(ms), ".%03u", (unsigned)(rec.millis % 1000));
+
+  char line[LOG_LINE_SIZE + 1];
+  int len = snprintf(line, sizeof(line),
+    "%.6f,%.6f,%d,%04d-%02d-%02d %02d:%02d:%02d%s,%d\n",
+    locValid ? rec.latE7 / 1e7 : 0.0,
+    locValid ? rec.lonE7 / 1e7 : 0.0,
+    (rec.flags & LOG_REC_SPEED_VALID) ? (int)rec.speedMph : -1,
+    y, mo, d, h, mi, s, ms,
+    (int)rec.rpm);
+  if (len < 0) return;
+  if (len > LOG_LINE_SIZE) { len = LOG_LINE_SIZE; line[LOG_LINE_SIZE-1] = '\n'; }
+  for (int i = len; i < LOG_LINE_SIZE; ++i) line[i] = ' ';
+  fwrite(line, 1, LOG_LINE_SIZE, out);
+}
+
+void writeEventLine(FILE *out, const LogEventRecord &ev, bool subSecond) {
+  if (!inWindow(ev.time)) return;
+  char line[LOG_JOURNAL_LINE_SIZE];
+  formatLogEventLine(line, ev, subSecond);
+  fwrite(line, 1, sizeof(line), out);
+  if (ev.type == LOG_EVENT_LOSS && ev.a > 0) fprintf(stderr, "%u samples dropped on the device\n", (unsigned)ev.a);
+}
+
+int decodeTrackFile(FILE *in, FILE *out, const LogFileHeader &hdr) {
+  // Newer record versions only append fields, so older files read as a prefix
+  if (hdr.version < 1 || hdr.version > LOG_BIN_VERSION || hdr.recordSize < 16 || hdr.recordSize > sizeof(LogRecord)) {
+    fprintf(stderr, "unsupported log version %d (record size %d)\n", hdr.version, hdr.recordSize);
+    return 1;
+  }
+  bool subSecond = hdr.version >= 2 && hdr.rateHz > 1;
+
+  fputs("lat,lon,speed_mph,UTC_datetime,RPM\n", out);
+  LogRecord rec = {};
+  while (fread(&rec, hdr.recordSize, 1, in) == 1) {
+    if (hdr.version >= 3 && isLogEvent(&rec)) {
+      LogEventRecord ev;
+      memcpy(&ev, &rec, sizeof(ev));
+      writeEventLine(out, ev, subSecond);
+    } else {
+      writeCsvLine(out, rec, subSecond);
+    }
+  }
+  return 0;
+}
+
+// ==================== SEEK INDEX ====================
+// Reads the seek index at the end of in. Without one, entries is empty and
+// dataEnd is the file size. Leaves the read position where it was.
+bool readSeekIndex(FILE *in, std::vector<LogIndexEntry> &entries, long &dataEnd) {
+  long pos = ftell(in);
+  fseek(in, 0, SEEK_END);
+  long size = ftell(in);
+  dataEnd = size;
+  LogIndexFooter f;
+  bool ok = size >= (long)sizeof(f) && fseek(in, size - sizeof(f), SEEK_SET) == 0 && fread(&f, sizeof(f), 1, in) == 1 &&
+            logIndexFooterValid(f, size);
+  if (ok) {
+    entries.resize(f.count);
+    fseek(in, f.dataEnd, SEEK_SET);
+    ok = fread(entries.data(), sizeof(LogIndexEntry), f.count, in) == f.count &&
+         crc32Update(0, entries.data(), f.count * sizeof(LogIndexEntry)) == f.crc;
+    if (ok) dataEnd = f.dataEnd;
+  }
+  if (!ok) entries.clear();
+  fseek(in, pos, SEEK_SET);
+  return ok;
+}
+
+int decodeDeltaFile(FILE *in, FILE *out, const LogFileHeader &hdr) {
+  if (hdr.version < 1 || hdr.version > LOG_DELTA_VERSION || hdr.rateHz == 0) {
+    fprintf(stderr, "unsupported delta log version %d\n", hdr.version);
+    return 1;
+  }
+  std::vector<LogIndexEntry> index;
+  long start = ftell(in), dataEnd;
+  readSeekIndex(in, index, dataEnd);
+  std::vector<uint8_t> body;
+  uint8_t chunk[4096];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0) body.insert(body.end(), chunk, chunk + n);
+  if (dataEnd - start < (long)body.size()) body.resize(dataEnd - start);
+
+  fputs("lat,lon,speed_mph,UTC_datetime,RPM\n", out);
+  const uint8_t *p = body.data(), *end = p + body.size();
+  uint32_t periodMs = 1000 / hdr.rateHz;
+  LogRecord rec = {};
+  bool synced = false;
+  while (p < end) {
+    LogEventRecord ev;
+    const uint8_t *next = hdr.version >= 2 ? decodeLogEvent(p, end, ev) : nullptr;
+    if (next) {
+      writeEventLine(out, ev, hdr.rateHz > 1);
+      p = next;
+      continue;
+    }
+    bool keyframe;
+    next = decodeLogDelta(p, end, rec, periodMs, keyframe);
+    if (!next || (!synced && !keyframe)) {
+      fprintf(stderr, "truncated or corrupt delta log at byte %zu\n", sizeof(hdr) + (size_t)(p - body.data()));
+      return 1;
+    }
+    synced = true;
+    writeCsvLine(out, rec, hdr.rateHz > 1);
+    p = next;
+  }
+  return 0;
+}
+
+// ==================== PULSE STREAM ====================
+// Walks the varint body, calling onPulse(t) for each edge (t in us on an
+// unwrapped 64-bit micros() axis), onSync(t, sync) and onDrops(total).
+template <typename OnPulse, typename OnSync, typename OnDrops>
+bool walkPulseBody(const std::vector<uint8_t> &body, uint32_t baseMicros,
+                   OnPulse onPulse, OnSync onSync, OnDrops onDrops) {
+  const uint8_t *p = body.data(), *end = p + body.size();
+  uint64_t t = baseMicros;
+  while (p < end) {
+    uint32_t v;
+    if (!(p = getVarint(p, end, v))) return false;
+    if (!(v & 1)) { t += v >> 1; onPulse(t); continue; }
+
+    uint8_t type = v >> 1;
+    size_t len = type == PULSE_REC_SYNC ? sizeof(PulseSync) : sizeof(uint32_t);
+    if (type < PULSE_REC_SYNC || type > PULSE_REC_PULSE_AT || (size_t)(end - p) < len) return false;
+    if (type == PULSE_REC_SYNC) {
+      PulseSync sync;
+      memcpy(&sync, p, sizeof(sync));
+      onSync(t + (int32_t)(sync.micros - (uint32_t)t), sync);
+    } else {
+      uint32_t u;
+      memcpy(&u, p, sizeof(u));
+      if (type == PULSE_REC_DROPS) onDrops(u);
+      else { t += u - (uint32_t)t; onPulse(t); }
+    }
+    p += len;
+  }
+  return true;
+}
+
+int decodePulseFile(FILE *in, FILE *out, const PulseFileHeader &hdr) {
+  if (hdr.version != PULSE_BIN_VERSION || hdr.pulsesPerRev == 0) {
+    fprintf(stderr, "unsupported pulse log version %d\n", hdr.version);
+    return 1;
+  }
+  std::vector<uint8_t> body;
+  uint8_t chunk[4096];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0) body.insert(body.end(), chunk, chunk + n);
+
+  // Pulses before the first sync are placed using that first sync
+  bool haveSync = false;
+  uint64_t syncT = 0;
+  PulseSync sync = {};
+  walkPulseBody(body, hdr.baseMicros, [](uint64_t) {},
+    [&](uint64_t t, const PulseSync &s) { if (!haveSync) { haveSync = true; syncT = t; sync = s; } },
+    [](uint32_t) {});
+
+  fputs("UTC_datetime,micros,period_us,RPM\n", out);
+  uint64_t prev = 0;
+  bool havePrev = false;
+  uint32_t drops = 0;
+  bool ok = walkPulseBody(body, hdr.baseMicros,
+    [&](uint64_t t) {
+      char utc[64] = "";
+      if (haveSync) {
+        int64_t us = (int64_t)sync.days * 86400000000LL + (int64_t)sync.msOfDay * 1000 + (int64_t)(t - syncT);
+        int y, mo, d;
+        civilFromDays2000((int32_t)(us / 86400000000LL), y, mo, d);
+        int64_t dayUs = us % 86400000000LL;
+        snprintf(utc, sizeof(utc), "%04d-%02d-%02d %02d:%02d:%02d.%06d", y, mo, d,
+                 (int)(dayUs / 3600000000LL), (int)(dayUs / 60000000 % 60), (int)(dayUs / 1000000 % 60), (int)(dayUs % 1000000));
+      }
+      if (havePrev && t > prev) {
+        uint64_t period = t - prev;
+        fprintf(out, "%s,%llu,%llu,%llu\n", utc, (unsigned long long)t, (unsigned long long)period,
+                (unsigned long long)(60000000ULL / hdr.pulsesPerRev / period));
+      } else {
+        fprintf(out, "%s,%llu,,\n", utc, (unsigned long long)t);
+      }
+      prev = t;
+      havePrev = true;
+    },
+    [&](uint64_t t, const PulseSync &s) { syncT = t; sync = s; },
+    [&](uint32_t total) { drops = total; havePrev = false; }); // a gap: no period across it
+
+  if (drops) fprintf(stderr, "%u pulses dropped on the device\n", drops);
+  if (!ok) { fprintf(stderr, "truncated or corrupt pulse log\n"); return 1; }
+  return 0;
+}
+
+// ==================== COMPRESSED BLOCKS ====================
+int decodeFile(FILE *in, FILE *out);
+void writeCsvLines(const uint8_t *p, size_t n, FILE *out);
+
+// Reads the frame at the read position and appends its block to inner.
+// 1 on success, 0 when no frame header is left, -1 for a damaged frame.
+int readFrame(FILE *in, uint32_t salt, std::vector<uint8_t> &inner, LogBlockFrame &f) {
+  static std::vector<uint8_t> payload, block(65535);
+  if (fread(&f, sizeof(f), 1, in) != 1) return 0;
+  payload.resize(f.storedLen);
+  long n = -1;
+  if (fread(payload.data(), 1, f.storedLen, in) == f.storedLen && logFrameValid(f, payload.data(), salt)) {
+    if (f.method == LOG_FRAME_LZ) n = lzDecompress(payload.data(), f.storedLen, block.data(), block.size());
+    else { memcpy(block.data(), payload.data(), f.storedLen); n = f.storedLen; }
+  }
+  if (n != f.rawLen) return -1;
+  inner.insert(inner.end(), block.begin(), block.begin() + n);
+  return 1;
+}
+
+// Decodes unpacked track data: binary inside through a temporary file, CSV
+// inside as is.
+int decodeInner(const std::vector<uint8_t> &inner, FILE *out) {
+  if (inner.size() >= 4 && (!memcmp(inner.data(), LOG_BIN_MAGIC, 4) || !memcmp(inner.data(), LOG_DELTA_MAGIC, 4))) {
+    FILE *tmp = tmpfile();
+    if (!tmp) { perror("tmpfile"); return 1; }
+    fwrite(inner.data(), 1, inner.size(), tmp);
+    rewind(tmp);
+    int rc = decodeFile(tmp, out);
+    fclose(tmp);
+    return rc;
+  }
+  if (!window.active) { fwrite(inner.data(), 1, inner.size(), out); return 0; }
+  size_t start = csvHeaderEnd(inner.data(), inner.size());
+  fwrite(inner.data(), 1, start, out);
+  writeCsvLines(inner.data() + start, inner.size() - start, out);
+  return 0;
+}
+
+int decodeCompressedFile(FILE *in, FILE *out, const LogFileHeader &hdr) {
+  if (hdr.version < 1 || hdr.version > LOG_LZ_VERSION) {
+    fprintf(stderr, "unsupported compressed log version %d\n", hdr.version);
+    return 1;
+  }
+  std::vector<LogIndexEntry> index;
+  long dataEnd;
+  readSeekIndex(in, index, dataEnd);
+  std::vector<uint8_t> inner;
+  LogBlockFrame f;
+  size_t frames = 0;
+  bool ok = true;
+  while (ftell(in) < dataEnd) {
+    int got = readFrame(in, hdr.salt, inner, f);
+    if (got == 0) break;
+    if (got < 0 || (hdr.version >= 2 && f.seq != (uint8_t)frames)) {
+      if (got > 0) inner.resize(inner.size() - f.rawLen);
+      ok = false;
+      break;
+    }
+    frames++;
+  }
+  if (!ok) fprintf(stderr, "bad frame %zu at byte %ld; keeping the blocks before it\n", frames, ftell(in));
+  int rc = decodeInner(inner, out);
+  return rc ? rc : !ok;
+}
+
+int decodeFile(FILE *in, FILE *out) {
+  uint8_t hdr[16];
+  if (fread(hdr, sizeof(hdr), 1, in) == 1) {
+    if (memcmp(hdr, LOG_BIN_MAGIC, 4) == 0) {
+      LogFileHeader h;
+      memcpy(&h, hdr, sizeof(h));
+      return decodeTrackFile(in, out, h);
+    }
+    if (memcmp(hdr, LOG_DELTA_MAGIC, 4) == 0) {
+      LogFileHeader h;
+      memcpy(&h, hdr, sizeof(h));
+      return decodeDeltaFile(in, out, h);
+    }
+    if (memcmp(hdr, LOG_LZ_MAGIC, 4) == 0) {
+      LogFileHeader h;
+      memcpy(&h, hdr, sizeof(h));
+      return decodeCompressedFile(in, out, h);
+    }
+    if (memcmp(hdr, PULSE_BIN_MAGIC, 4) == 0) {
+      PulseFileHeader h;
+      memcpy(&h, hdr, sizeof(h));
+      return decodePulseFile(in, out, h);
+    }
+  }
+  fprintf(stderr, "not a Mini Logger binary log\n");
+  return 1;
+}
+
+// ==================== TIME RANGE ====================
+// Seconds since 2000 of "YYYY-MM-DD hh:mm:ss"; -1 if it does not parse.
+int64_t parseUtc(const char *text) {
+  int y, mo, d, h, mi, s;
+  if (sscanf(text, "%4d-%2d-%2d%*[ T]%2d:%2d:%2d", &y, &mo, &d, &h, &mi, &s) != 6) return -1;
+  return (int64_t)daysSince2000(y, mo, d) * 86400 + h * 3600 + mi * 60 + s;
+}
+
+// Time of a device CSV line, sample or event; -1 for journal trailers and
+// anything else without one.
+int64_t csvLineTime(const uint8_t *line) {
+  char text[LOG_LINE_SIZE + 1];
+  memcpy(text, line, LOG_LINE_SIZE);
+  text[LOG_LINE_SIZE] = 0;
+  const char *p = text;
+  if (text[0] == '#') {
+    if (text[1] == 'J' || text[2] != ',') return -1;
+    p += 3;
+  } else {
+    for (int commas = 0; commas < 3; ++p) {
+      if (!*p || *p == '\n') return -1;
+      if (*p == ',') commas++;
+    }
+  }
+  return parseUtc(p);
+}
+
+// Writes the device CSV lines in the window, without journal trailers.
+void writeCsvLines(const uint8_t *p, size_t n, FILE *out) {
+  for (; n >= LOG_LINE_SIZE; p += LOG_LINE_SIZE, n -= LOG_LINE_SIZE) {
+    int64_t t = csvLineTime(p);
+    if (t >= 0 && inWindow(t)) fwrite(p, 1, LOG_LINE_SIZE, out);
+  }
+}
+
+// First of n slots whose time is >= t, for slots in time order.
+template <typename TimeAt>
+long lowerBound(long n, int64_t t, TimeAt timeAt) {
+  long lo = 0, hi = n;
+  while (lo < hi) {
+    long mid = lo + (hi - lo) / 2;
+    if (timeAt(mid) < t) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+std::vector<uint8_t> readBytes(FILE *in, long from, long to) {
+  std::vector<uint8_t> bytes(to > from ? to - from : 0);
+  fseek(in, from, SEEK_SET);
+  bytes.resize(fread(bytes.data(), 1, bytes.size(), in));
+  return bytes;
+}
+
+// Decodes header + the bytes [from, to) of in as if they were a whole log.
+int decodeSlice(FILE *in, const uint8_t *hdr, size_t hdrLen, long from, long to, FILE *out) {
+  std::vector<uint8_t> slice(hdr, hdr + hdrLen), body = readBytes(in, from, to);
+  slice.insert(slice.end(), body.begin(), body.end());
+  FILE *tmp = tmpfile();
+  if (!tmp) { perror("tmpfile"); return 1; }
+  fwrite(slice.data(), 1, slice.size(), tmp);
+  rewind(tmp);
+  int rc = decodeFile(tmp, out);
+  fclose(tmp);
+  return rc;
+}
+
+// Decodes the window set in window, reading only the part of the log it needs.
+int decodeRange(FILE *in, FILE *out) {
+  uint8_t head[LOG_LINE_SIZE] = {};
+  size_t got = fread(head, 1, sizeof(head), in);
+  fseek(in, 0, SEEK_END);
+  long size = ftell(in);
+  LogFileHeader hdr;
+  memcpy(&hdr, head, sizeof(hdr));
+  long from = 0, to = 0;
+
+  if (got >= sizeof(hdr) && !memcmp(head, LOG_BIN_MAGIC, 4) && hdr.recordSize >= 16) {
+    // Fixed-size records: bisect them directly
+    auto timeAt = [&](long k) -> int64_t {
+      LogRecord rec = {};
+      fseek(in, sizeof(hdr) + k * hdr.recordSize, SEEK_SET);
+      return fread(&rec, hdr.recordSize, 1, in) == 1 ? rec.time : INT64_MAX;
+    };
+    long n = (size - (long)sizeof(hdr)) / hdr.recordSize;
+    from = sizeof(hdr) + lowerBound(n, window.from, timeAt) * hdr.recordSize;
+    to = sizeof(hdr) + lowerBound(n, window.to, timeAt) * hdr.recordSize;
+    fprintf(stderr, "decoding bytes %ld..%ld of %ld\n", from, to, size);
+    return decodeSlice(in, head, sizeof(hdr), from, to, out);
+  }
+
+  long start = csvHeaderEnd(head, got);
+  if (start && !memcmp(head, "lat,", 4)) {
+    // Device CSV: the column line, then 64-byte lines; trailers take the next line's time
+    long n = (size - start) / LOG_LINE_SIZE;
+    auto timeAt = [&](long k) -> int64_t {
+      uint8_t line[LOG_LINE_SIZE];
+      fseek(in, start + k * LOG_LINE_SIZE, SEEK_SET);
+      for (; k < n && fread(line, 1, sizeof(line), in) == sizeof(line); ++k) {
+        int64_t t = csvLineTime(line);
+        if (t >= 0) return t;
+      }
+      return INT64_MAX;
+    };
+    from = start + lowerBound(n, window.from, timeAt) * LOG_LINE_SIZE;
+    to = start + lowerBound(n, window.to, timeAt) * LOG_LINE_SIZE;
+    fprintf(stderr, "decoding bytes %ld..%ld of %ld\n", from, to, size);
+    std::vector<uint8_t> lines = readBytes(in, from, to);
+    fwrite(head, 1, start, out);
+    writeCsvLines(lines.data(), lines.size(), out);
+    return 0;
+  }
+
+  bool delta = !memcmp(head, LOG_DELTA_MAGIC, 4), packed = !memcmp(head, LOG_LZ_MAGIC, 4);
+  std::vector<LogIndexEntry> index;
+  long dataEnd;
+  if (got < sizeof(hdr) || (!delta && !packed)) {
+    rewind(in);
+    return decodeFile(in, out);
+  }
+  if (!readSeekIndex(in, index, dataEnd)) {
+    fprintf(stderr, "no seek index: decoding the whole log\n");
+    rewind(in);
+    return decodeFile(in, out);
+  }
+  // From the last block that starts before the window to the first that starts after it
+  auto timeAt = [&](long k) -> int64_t { return index[k].time; };
+  long first = lowerBound(index.size(), window.from, timeAt) - 1, last = lowerBound(index.size(), window.to, timeAt);
+  from = first >= 0 ? (long)index[first].offset : (long)sizeof(hdr);
+  to = last < (long)index.size() ? (long)index[last].offset : dataEnd;
+  fprintf(stderr, "decoding bytes %ld..%ld of %ld\n", from, to, size);
+  if (delta) return decodeSlice(in, head, sizeof(hdr), from, to, out);
+
+  // Compressed: the first frame carries the inner header, the rest are whole blocks
+  std::vector<uint8_t> inner;
+  LogBlockFrame f;
+  if (from > (long)sizeof(hdr)) {
+    fseek(in, sizeof(hdr), SEEK_SET);
+    if (readFrame(in, hdr.salt, inner, f) <= 0) { fprintf(stderr, "bad first frame\n"); return 1; }
+    size_t innerHdr = 16;
+    if (memcmp(inner.data(), LOG_BIN_MAGIC, 4) && memcmp(inner.data(), LOG_DELTA_MAGIC, 4)) {
+      innerHdr = csvHeaderEnd(inner.data(), inner.size());
+    }
+    inner.resize(innerHdr);
+  }
+  fseek(in, from, SEEK_SET);
+  while (ftell(in) < to) {
+    if (readFrame(in, hdr.salt, inner, f) <= 0) { fprintf(stderr, "bad frame at byte %ld\n", ftell(in)); break; }
+  }
+  return decodeInner(inner, out);
+}
+
+// ==================== SUMMARY ====================
+#define SUMMARY_HEAD_LINES 8    // header records sit right after the column line
+#define SUMMARY_TAIL_LINES 16   // footer, loss totals and journal trailers
+
+bool isSummaryLine(const char *line) {
+  return line[0] == '#' && line[1] && strchr("SCTVBW", line[1]) && line[2] == ',';
+}
+
+bool printSummaryLine(const char *line, size_t n, FILE *out) {
+  if (n < 3 || !isSummaryLine(line)) return false;
+  while (n > 0 && (line[n - 1] == ' ' || line[n - 1] == '\n' || line[n - 1] == '\r')) n--;
+  fwrite(line, 1, n, out);
+  fputc('\n', out);
+  return line[1] == 'T';
+}
+
+// Calls visit(first, count) for the first and last few of count slots, once each.
+template <typename Visit>
+void visitHeadAndTail(long count, Visit visit) {
+  if (count <= SUMMARY_HEAD_LINES + SUMMARY_TAIL_LINES) { visit(0, count); return; }
+  visit(0, SUMMARY_HEAD_LINES);
+  visit(count - SUMMARY_TAIL_LINES, SUMMARY_TAIL_LINES);
+}
+
+// Prints the summary lines of a log; true when a footer was found.
+bool summarizeFile(FILE *in, FILE *out) {
+  char head[64] = "";
+  size_t got = fread(head, 1, sizeof(head), in);
+  fseek(in, 0, SEEK_END);
+  long size = ftell(in);
+  bool footer = false;
+
+  if (got >= sizeof(LogFileHeader) && !memcmp(head, LOG_BIN_MAGIC, 4)) {
+    LogFileHeader h;
+    memcpy(&h, head, sizeof(h));
+    if (h.version >= 3 && h.recordSize == sizeof(LogRecord)) {
+      visitHeadAndTail((size - (long)sizeof(h)) / h.recordSize, [&](long first, long n) {
+        fseek(in, sizeof(h) + first * h.recordSize, SEEK_SET);
+        LogEventRecord ev;
+        while (n-- > 0 && fread(&ev, sizeof(ev), 1, in) == 1) {
+          if (!isLogEvent(&ev)) continue;
+          char line[LOG_JOURNAL_LINE_SIZE];
+          formatLogEventLine(line, ev, h.rateHz > 1);
+          footer |= printSummaryLine(line, sizeof(line), out);
+        }
+      });
+      return footer;
+    }
+  }
+  long start = csvHeaderEnd((const uint8_t*)head, got);
+  if (start && !memcmp(head, "lat,", 4)) {
+    // Device CSV: the column line, then LOG_LINE_SIZE lines
+    visitHeadAndTail((size - start) / LOG_LINE_SIZE, [&](long first, long n) {
+      fseek(in, start + first * LOG_LINE_SIZE, SEEK_SET);
+      char line[LOG_LINE_SIZE];
+      while (n-- > 0 && fread(line, 1, sizeof(line), in) == sizeof(line))
+        footer |= printSummaryLine(line, sizeof(line), out);
+    });
+    return footer;
+  }
+
+  // Delta and compressed logs: decode in full and keep the summary lines
+  rewind(in);
+  FILE *tmp = tmpfile();
+  if (!tmp) { perror("tmpfile"); return false; }
+  decodeFile(in, tmp);
+  rewind(tmp);
+  char line[256];
+  while (fgets(line, sizeof(line), tmp)) {
+    const char *l = line + strspn(line, " "); // sample lines are padded after their newline
+    footer |= printSummaryLine(l, strlen(l), out);
+  }
+  fclose(tmp);
+  return footer;
+}
+
+int main(int argc, char **argv) {
+  bool summary = argc == 3 && !strcmp(argv[1], "-s");
+  if (argc == 5 && !strcmp(argv[1], "-t")) {
+    int64_t from = parseUtc(argv[2]), to = parseUtc(argv[3]);
+    if (from < 0 || to < from) { fprintf(stderr, "times are \"YYYY-MM-DD hh:mm:ss\", FROM <= TO\n"); return 2; }
+    window = TimeWindow{true, (uint32_t)from, (uint32_t)to};
+  } else if (argc != 2 && !summary) {
+    fprintf(stderr, "usage: %s LOGFILE.BIN > LOGFILE.CSV\n       %s -s LOGFILE\n"
+                    "       %s -t \"YYYY-MM-DD hh:mm:ss\" \"YYYY-MM-DD hh:mm:ss\" LOGFILE\n", argv[0], argv[0], argv[0]);
+    return 2;
+  }
+  const char *path = argv[argc - 1];
+  FILE *in = fopen(path, "rb");
+  if (!in) { perror(path); return 1; }
+  int rc;
+  if (summary) {
+    rc = !summarizeFile(in, stdout);
+    if (rc) fprintf(stderr, "no footer: the log was not closed, or predates footers\n");
+  } else if (window.active) {
+    rc = decodeRange(in, stdout);
+  } else {
+    rc = decodeFile(in, stdout);
+  }
+  fclose(in);
+  return rc;
+}
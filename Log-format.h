@@ -0,0 +1,701 @@
+/*
+  Mini Logger - Log Format
+  - On-disk layouts shared by the sketch and the host tools
+  - Integer-only CSV line formatter (no soft-float printf on the ESP32-C3)
+
+  Everything here is plain C++ so it builds for both the device and the host.
+*/
+
+#ifndef MINI_LOGGER_LOG_FORMAT_H
+#define MINI_LOGGER_LOG_FORMAT_H
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// ==================== BINARY LAYOUT ====================
+// LOG_FORMAT_BINARY files, little-endian
+#define LOG_BIN_MAGIC "MLB1"
+#define LOG_BIN_VERSION 3   // v2 appended LogRecord.millis; v1 records are its 16-byte prefix; v3 adds events
+#define LOG_REC_LOCATION_VALID 0x01
+#define LOG_REC_SPEED_VALID    0x02
+#define LOG_REC_DATE_VALID     0x04
+#define LOG_REC_TIME_VALID     0x08
+#define LOG_REC_EVENT          0x80   // v3: the slot holds a LogEventRecord, not a sample
+
+struct __attribute__((packed)) LogFileHeader {
+  char magic[4];       // LOG_BIN_MAGIC
+  uint8_t version;     // LOG_BIN_VERSION
+  uint8_t recordSize;  // sizeof(LogRecord)
+  uint8_t rateHz;      // LOG_RATE_HZ the file was written at
+  uint32_t salt;       // LOG_LZ_MAGIC v2: random per file, seeds every frame crc; else 0
+  uint8_t reserved[5];
+};
+
+struct __attribute__((packed)) LogRecord {
+  int32_t latE7;       // degrees * 1e7
+  int32_t lonE7;
+  uint32_t time;       // seconds since 2000-01-01 00:00:00 UTC
+  uint16_t rpm;
+  uint8_t speedMph;    // rounded, clamped to 255
+  uint8_t flags;       // LOG_REC_*
+  uint16_t millis;     // sub-second part of time
+};
+static_assert(sizeof(LogRecord) == 18, "LogRecord layout is part of the file format");
+
+// Device state logged in line with the samples. time, millis and the DATE/TIME
+// flags sit where LogRecord has them; flags always has LOG_REC_EVENT.
+#define LOG_EVENT_LOSS      1   // totals for the session: a = samples dropped, b = SD write retries, c = file reopens
+#define LOG_EVENT_CONTINUES 2   // first record after a rollover: a = YYMMDD and c = index of the previous file
+#define LOG_EVENT_SESSION   3   // header, at the top of each file: a = firmware build YYMMDDhhmm, b = LOG_CFG_*, c = rate in Hz
+#define LOG_EVENT_TOTALS    4   // footer, for the file: a = samples, b = distance in metres, c = max RPM
+#define LOG_EVENT_SPEED     5   // footer: a = max speed, b = mean speed x 100 (mph, over samples with a speed)
+#define LOG_EVENT_BOUNDS    6   // footer: a = lat, b = lon (degrees x 1e7) of the SW (c = 0) or NE (c = 1) corner
+#define LOG_EVENT_MARKER    7   // a = LOG_MARK_*, b = its number in the session (1, 2...), c = note id (0: none)
+#define LOG_EVENT_SWAP      8   // after #C in a file opened on a swapped card: a = ms without a card, b = samples lost meanwhile
+#define LOG_EVENT_LATENCY   9   // health record per LOG_LAT_* since the last: a = operations (<= 99999), b = slowest in us (<= 9999999),
+                                // c = logLatencyTag(kind, p50 bucket, p99 bucket)
+
+// LOG_EVENT_MARKER a: what the marker is
+#define LOG_MARK_LAP     1      // long press on the button
+#define LOG_MARK_POINT   2      // a place worth finding again
+#define LOG_MARK_KINDS   2
+
+// LOG_EVENT_SESSION b: how the device was set up
+#define LOG_CFG_FORMAT   0x03   // LOG_FORMAT: 0 CSV, 1 binary, 2 delta
+#define LOG_CFG_COMPRESS 0x04
+#define LOG_CFG_PULSE    0x08
+#define LOG_CFG_SYNC     0x30   // LOG_SYNC_POLICY << 4
+
+struct __attribute__((packed)) LogEventRecord {
+  uint32_t a;
+  uint32_t b;
+  uint32_t time;
+  uint16_t c;
+  uint8_t type;        // LOG_EVENT_*
+  uint8_t flags;       // LOG_REC_EVENT | LOG_REC_DATE_VALID | LOG_REC_TIME_VALID
+  uint16_t millis;
+};
+static_assert(sizeof(LogEventRecord) == sizeof(LogRecord) &&
+              offsetof(LogEventRecord, flags) == offsetof(LogRecord, flags), "events share the record slot");
+
+inline bool isLogEvent(const void *rec) {
+  uint8_t flags = ((const uint8_t*)rec)[offsetof(LogRecord, flags)];
+  return (flags & LOG_REC_EVENT) && !(flags & 0x70);
+}
+
+// An event stamped with a sample's date and time.
+inline LogEventRecord logEventAt(uint8_t type, uint32_t a, uint32_t b, uint16_t c, const LogRecord &at) {
+  return {a, b, at.time, c, type, (uint8_t)(LOG_REC_EVENT | (at.flags & (LOG_REC_DATE_VALID | LOG_REC_TIME_VALID))),
+          at.millis};
+}
+static_assert(sizeof(LogFileHeader) == 16, "LogFileHeader layout is part of the file format");
+
+// ==================== PULSE STREAM LAYOUT ====================
+// /RYYMMDDxx.BIN: every hall edge, little-endian. After the header the body is
+// a sequence of varints. An even value v is a pulse v/2 us after the previous
+// one (the first one counts from baseMicros). An odd value starts a record of
+// type v/2 followed by its fixed-size payload.
+#define PULSE_BIN_MAGIC "MLP1"
+#define PULSE_BIN_VERSION 1
+#define PULSE_REC_SYNC     1   // PulseSync: micros() at a GPS UTC instant
+#define PULSE_REC_DROPS    2   // uint32_t: pulses lost so far in this file
+#define PULSE_REC_PULSE_AT 3   // uint32_t: micros() of a pulse too far from the previous one for a delta
+
+struct __attribute__((packed)) PulseFileHeader {
+  char magic[4];       // PULSE_BIN_MAGIC
+  uint8_t version;     // PULSE_BIN_VERSION
+  uint8_t pulsesPerRev;
+  uint8_t reserved[6];
+  uint32_t baseMicros; // micros() when the file was opened
+};
+
+struct __attribute__((packed)) PulseSync {
+  uint32_t micros;
+  int32_t days;        // since 2000-01-01 UTC
+  uint32_t msOfDay;
+};
+static_assert(sizeof(PulseFileHeader) == 16, "PulseFileHeader layout is part of the file format");
+
+// ==================== VARINTS ====================
+// LEB128: 7 bits per byte, low group first, high bit set on all but the last byte
+#define VARINT32_MAX_BYTES 5
+
+inline uint8_t *putVarint(uint8_t *p, uint32_t v) {
+  while (v >= 0x80) { *p++ = (uint8_t)(v | 0x80); v >>= 7; }
+  *p++ = (uint8_t)v;
+  return p;
+}
+
+// Returns the byte after the varint, or nullptr if it runs past end.
+inline const uint8_t *getVarint(const uint8_t *p, const uint8_t *end, uint32_t &v) {
+  v = 0;
+  for (int shift = 0; p < end && shift < 35; shift += 7) {
+    uint8_t b = *p++;
+    v |= (uint32_t)(b & 0x7F) << shift;
+    if (!(b & 0x80)) return p;
+  }
+  return nullptr;
+}
+
+// ==================== DELTA TRACK LAYOUT ====================
+// LOG_FORMAT_DELTA files: LogFileHeader with LOG_DELTA_MAGIC, then records of
+//   LOG_DELTA_KEYFRAME + LogRecord           full sample, decodable on its own
+//   LOG_DELTA_EVENT + LogEventRecord         (v2) not a sample, leaves the chain alone
+//   mask (LOG_DELTA_PRESENT | LOG_DELTA_*)   then one zig-zag varint per set bit,
+//                                            in bit order, relative to the previous sample
+// Time deltas are in ms and stored only when they differ from the nominal
+// sample period (LogFileHeader.rateHz).
+#define LOG_DELTA_MAGIC "MLD1"
+#define LOG_DELTA_VERSION 2
+#define LOG_DELTA_KEYFRAME 0xFF
+#define LOG_DELTA_EVENT    0xFE
+#define LOG_DELTA_PRESENT  0x40   // set on every delta mask so zero-filled space never parses
+#define LOG_DELTA_LAT      0x01
+#define LOG_DELTA_LON      0x02
+#define LOG_DELTA_TIME     0x04   // ms beyond the nominal period
+#define LOG_DELTA_RPM      0x08
+#define LOG_DELTA_SPEED    0x10
+#define LOG_DELTA_FLAGS    0x20   // new flags byte, stored as-is
+#define LOG_DELTA_MAX_BYTES (2 + 5 * VARINT32_MAX_BYTES)  // worst-case delta; a keyframe is 19
+
+inline uint32_t zigzag32(int32_t v) { return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31); }
+inline int32_t unzigzag32(uint32_t v) { return (int32_t)(v >> 1) ^ -(int32_t)(v & 1); }
+
+inline uint64_t logRecordMillis(const LogRecord &r) { return (uint64_t)r.time * 1000 + r.millis; }
+
+// Encodes cur against prev (ignored for keyframes); returns bytes written,
+// at most LOG_DELTA_MAX_BYTES.
+inline size_t encodeLogDelta(uint8_t *out, const LogRecord &prev, const LogRecord &cur,
+                             uint32_t periodMs, bool keyframe) {
+  if (keyframe) {
+    out[0] = LOG_DELTA_KEYFRAME;
+    memcpy(out + 1, &cur, sizeof(cur));
+    return 1 + sizeof(cur);
+  }
+  int32_t dt = (int32_t)(logRecordMillis(cur) - logRecordMillis(prev)) - (int32_t)periodMs;
+  uint8_t mask = LOG_DELTA_PRESENT;
+  uint8_t *p = out + 1;
+  if (cur.latE7 != prev.latE7) { mask |= LOG_DELTA_LAT; p = putVarint(p, zigzag32(cur.latE7 - prev.latE7)); }
+  if (cur.lonE7 != prev.lonE7) { mask |= LOG_DELTA_LON; p = putVarint(p, zigzag32(cur.lonE7 - prev.lonE7)); }
+  if (dt != 0) { mask |= LOG_DELTA_TIME; p = putVarint(p, zigzag32(dt)); }
+  if (cur.rpm != prev.rpm) { mask |= LOG_DELTA_RPM; p = putVarint(p, zigzag32((int32_t)cur.rpm - prev.rpm)); }
+  if (cur.speedMph != prev.speedMph) { mask |= LOG_DELTA_SPEED; p = putVarint(p, zigzag32((int32_t)cur.speedMph - prev.speedMph)); }
+  if (cur.flags != prev.flags) { mask |= LOG_DELTA_FLAGS; *p++ = cur.flags; }
+  out[0] = mask;
+  return p - out;
+}
+
+// Decodes one record into rec (which holds the previous sample on entry).
+// Returns the byte after it, or nullptr if the bytes are not a valid record.
+inline const uint8_t *decodeLogDelta(const uint8_t *p, const uint8_t *end, LogRecord &rec,
+                                     uint32_t periodMs, bool &keyframe) {
+  if (p >= end) return nullptr;
+  uint8_t mask = *p++;
+  keyframe = mask == LOG_DELTA_KEYFRAME;
+  if (keyframe) {
+    if ((size_t)(end - p) < sizeof(rec)) return nullptr;
+    LogRecord key;
+    memcpy(&key, p, sizeof(key));
+    if (key.flags & 0xF0) return nullptr;
+    rec = key;
+    return p + sizeof(rec);
+  }
+  if ((mask & 0xC0) != LOG_DELTA_PRESENT) return nullptr;
+  LogRecord next = rec;
+  uint32_t v = 0;
+  int32_t dt = 0;
+  if ((mask & LOG_DELTA_LAT) && (p = getVarint(p, end, v))) next.latE7 += unzigzag32(v);
+  if (p && (mask & LOG_DELTA_LON) && (p = getVarint(p, end, v))) next.lonE7 += unzigzag32(v);
+  if (p && (mask & LOG_DELTA_TIME) && (p = getVarint(p, end, v))) dt = unzigzag32(v);
+  if (p && (mask & LOG_DELTA_RPM) && (p = getVarint(p, end, v))) next.rpm += unzigzag32(v);
+  if (p && (mask & LOG_DELTA_SPEED) && (p = getVarint(p, end, v))) next.speedMph += unzigzag32(v);
+  if (p && (mask & LOG_DELTA_FLAGS)) { if (p >= end || (*p & 0xF0)) return nullptr; next.flags = *p++; }
+  if (!p) return nullptr;
+  uint64_t ms = logRecordMillis(rec) + periodMs + dt;
+  next.time = (uint32_t)(ms / 1000);
+  next.millis = (uint16_t)(ms % 1000);
+  rec = next;
+  return p;
+}
+
+inline size_t encodeLogEvent(uint8_t *out, const LogEventRecord &ev) {
+  out[0] = LOG_DELTA_EVENT;
+  memcpy(out + 1, &ev, sizeof(ev));
+  return 1 + sizeof(ev);
+}
+
+// Returns the byte after an event record at p, or nullptr if there is none.
+inline const uint8_t *decodeLogEvent(const uint8_t *p, const uint8_t *end, LogEventRecord &ev) {
+  if (p >= end || *p != LOG_DELTA_EVENT || (size_t)(end - p) < 1 + sizeof(ev) || !isLogEvent(p + 1)) return nullptr;
+  memcpy(&ev, p + 1, sizeof(ev));
+  return p + 1 + sizeof(ev);
+}
+
+// ==================== COMPRESSED BLOCK LAYOUT ====================
+// LOG_COMPRESS files: LogFileHeader with LOG_LZ_MAGIC, then one LogBlockFrame
+// plus payload per writer block. Concatenating the unpacked payloads gives the
+// file the sketch would have written uncompressed (CSV, BIN or delta).
+// v2 numbers the frames and seeds their crc with LogFileHeader.salt, so frames
+// an older log left in pre-allocated space never pass as this file's.
+#define LOG_LZ_MAGIC "MLZ1"
+#define LOG_LZ_VERSION 2
+#define LOG_FRAME_SYNC   0x5A4C   // "LZ"
+#define LOG_FRAME_STORED 0        // payload is the raw block (did not compress)
+#define LOG_FRAME_LZ     1        // payload is an LZ4-format block (Log-compress.h)
+
+struct __attribute__((packed)) LogBlockFrame {
+  uint16_t sync;       // LOG_FRAME_SYNC
+  uint16_t storedLen;  // payload bytes following this header
+  uint16_t rawLen;     // block bytes once unpacked
+  uint8_t method;      // LOG_FRAME_STORED or LOG_FRAME_LZ
+  uint8_t seq;         // frame number in the file, mod 256 (0 in v1)
+  uint32_t crc;        // crc32 from the file salt over the 8 bytes above, then the payload
+};
+static_assert(sizeof(LogBlockFrame) == 12, "LogBlockFrame layout is part of the file format");
+
+// ==================== CHECKSUMS ====================
+// CRC-32 (IEEE 802.3, as zlib), nibble table: 64 bytes instead of 1 KB.
+// Start with crc = 0 and feed data in as many pieces as needed.
+inline uint32_t crc32Update(uint32_t crc, const void *data, size_t len) {
+  static const uint32_t table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+  };
+  const uint8_t *p = (const uint8_t*)data;
+  crc = ~crc;
+  while (len--) {
+    crc ^= *p++;
+    crc = (crc >> 4) ^ table[crc & 15];
+    crc = (crc >> 4) ^ table[crc & 15];
+  }
+  return ~crc;
+}
+
+inline uint32_t logFrameCrc(const LogBlockFrame &f, const uint8_t *payload, uint32_t salt) {
+  return crc32Update(crc32Update(salt, &f, offsetof(LogBlockFrame, crc)), payload, f.storedLen);
+}
+
+// ==================== CSV BLOCK JOURNAL ====================
+// CSV logs carry a 64-byte trailer line after every block the writer flushes:
+//   #J,<seq>,<bytes>,<salt>,<crc>     seq and bytes decimal, salt and crc hex
+// bytes and crc32 cover the block since the previous trailer. Block 0 is the
+// header line, journaled when the file is created; salt is random per file so
+// blocks an older log left in pre-allocated space never validate. Viewers drop
+// the line as a non-numeric row.
+// The writer ends every block on a sector boundary with "#P" pad lines before
+// its trailer, so no sector is written twice; they count in bytes and crc32.
+#define LOG_JOURNAL_LINE_SIZE 64
+#define LOG_JOURNAL_TAG "#J,"
+#define LOG_JOURNAL_PAD_TAG "#P"
+
+inline void formatJournalLine(char *out, uint32_t seq, uint32_t bytes, uint32_t salt, uint32_t crc) {
+  int len = snprintf(out, LOG_JOURNAL_LINE_SIZE, LOG_JOURNAL_TAG "%lu,%lu,%08lx,%08lx", (unsigned long)seq,
+                     (unsigned long)bytes, (unsigned long)salt, (unsigned long)crc);
+  memset(out + len, ' ', LOG_JOURNAL_LINE_SIZE - len);
+  out[LOG_JOURNAL_LINE_SIZE - 1] = '\n';
+}
+
+inline void formatJournalPadLine(char *out) {
+  memset(out, ' ', LOG_JOURNAL_LINE_SIZE);
+  memcpy(out, LOG_JOURNAL_PAD_TAG, 2);
+  out[LOG_JOURNAL_LINE_SIZE - 1] = '\n';
+}
+
+inline bool parseJournalLine(const char *line, uint32_t &seq, uint32_t &bytes, uint32_t &salt, uint32_t &crc) {
+  unsigned long v[4];
+  int used = 0;
+  if (memcmp(line, LOG_JOURNAL_TAG, 3) != 0 ||
+      sscanf(line + 3, "%lu,%lu,%8lx,%8lx%n", &v[0], &v[1], &v[2], &v[3], &used) != 4) return false;
+  for (int i = 3 + used; i < LOG_JOURNAL_LINE_SIZE - 1; ++i) if (line[i] != ' ') return false;
+  seq = v[0]; bytes = v[1]; salt = v[2]; crc = v[3];
+  return line[LOG_JOURNAL_LINE_SIZE - 1] == '\n';
+}
+
+// Finds where a journaled CSV log stops being intact. Feed the file from its
+// first byte until done; cut it at end.
+struct LogJournalScan {
+  size_t pos = 0;          // bytes fed so far
+  size_t end = 0;          // end of the last intact block's trailer
+  uint32_t blocks = 0;     // intact blocks, header included
+  uint32_t records = 0;    // sample lines in the intact blocks
+  uint32_t lines = 0;      // lines of the current block so far
+  bool done = false;       // the rest is a torn block, another file's data or garbage
+  uint32_t salt = 0;
+  uint32_t crc = 0;        // over the current block's lines so far
+  char line[LOG_JOURNAL_LINE_SIZE];
+  size_t lineLen = 0;
+};
+
+inline void logJournalFeed(LogJournalScan &j, const uint8_t *p, size_t n) {
+  for (; n > 0 && !j.done; --n, ++p, ++j.pos) {
+    if (j.lineLen == sizeof(j.line)) { j.done = true; return; } // no log line is longer
+    // Track lines are space padded after their '\n': keep it out of the next line
+    if (j.lineLen == 0 && *p == ' ') { j.crc = crc32Update(j.crc, p, 1); continue; }
+    j.line[j.lineLen++] = (char)*p;
+    if (*p != '\n') continue;
+
+    size_t len = j.lineLen;
+    j.lineLen = 0;
+    uint32_t seq, bytes, salt, crc;
+    if (len == LOG_JOURNAL_LINE_SIZE && parseJournalLine(j.line, seq, bytes, salt, crc)) {
+      if (seq != j.blocks || bytes != j.pos + 1 - len - j.end || crc != j.crc ||
+          (j.blocks > 0 && salt != j.salt)) { j.done = true; return; }
+      j.salt = salt;
+      if (j.blocks++ > 0) j.records += j.lines;
+      j.lines = 0;
+      j.crc = 0;
+      j.end = j.pos + 1;
+    } else {
+      j.crc = crc32Update(j.crc, j.line, len);
+      if (j.line[0] != '#') j.lines++; // event lines are not samples
+    }
+  }
+}
+
+// ==================== RECORD SCAN ====================
+// Pre-allocated space past a binary or delta log's last write holds whatever the card
+// had there, often an older log whose records each look valid on their own.
+// A scan keeps records only while their times follow on: samples never go
+// back in time nor jump more than LOG_SCAN_MAX_GAP_MS ahead, and events stay
+// within that gap of the last sample. Records without a date and time pass.
+#define LOG_SCAN_MAX_GAP_MS 60000
+
+struct LogRecordScan {
+  uint32_t records = 0;    // samples kept
+  bool seen = false;       // lastMs is set...
+  bool sampled = false;    // ...by a sample, not just an event
+  uint64_t lastMs = 0;
+};
+
+// Whether rec (a LogRecord or LogEventRecord slot) carries on from the records
+// kept so far; keeps it if so.
+inline bool logRecordScanNext(LogRecordScan &s, const void *rec) {
+  LogRecord r;
+  memcpy(&r, rec, sizeof(r)); // events keep time, millis and flags in the same place
+  bool event = isLogEvent(rec);
+  if (!event && (!(r.flags & LOG_REC_LOCATION_VALID) || (r.flags & 0xF0))) return false;
+  if ((r.flags & (LOG_REC_DATE_VALID | LOG_REC_TIME_VALID)) == (LOG_REC_DATE_VALID | LOG_REC_TIME_VALID)) {
+    uint64_t ms = logRecordMillis(r);
+    if (s.seen) {
+      uint64_t lo = s.sampled && !event ? s.lastMs : s.lastMs > LOG_SCAN_MAX_GAP_MS ? s.lastMs - LOG_SCAN_MAX_GAP_MS : 0;
+      if (ms < lo || ms > s.lastMs + LOG_SCAN_MAX_GAP_MS) return false;
+    }
+    if (!event || !s.seen) { s.lastMs = ms; s.seen = true; s.sampled = !event; }
+  }
+  if (!event) s.records++;
+  return true;
+}
+
+// The same for a delta log's body, fed in chunks of any size from the byte
+// after its header until done, then closed with logDeltaScanEnd(); cut the
+// body at end. Its first sample must be a keyframe. A record is decoded once
+// a whole worst-case one is buffered, so a chunk boundary never cuts one short.
+struct LogDeltaScan {
+  explicit LogDeltaScan(uint32_t period) : periodMs(period) {}
+  uint32_t periodMs;       // the file's nominal sample period
+  LogRecordScan times;     // times.records: samples before end
+  size_t end = 0;          // body bytes in records that follow on
+  bool done = false;       // the rest is a torn record, another file's data or garbage
+  bool keyed = false;
+  LogRecord rec = {};      // the last sample, for the next delta
+  uint8_t buf[LOG_DELTA_MAX_BYTES];
+  size_t have = 0;
+};
+
+// Takes one record off the front of s.buf; false if it does not follow on.
+inline bool logDeltaScanStep(LogDeltaScan &s) {
+  const uint8_t *p = s.buf, *end = s.buf + s.have;
+  LogEventRecord ev;
+  const uint8_t *next = decodeLogEvent(p, end, ev);
+  if (next) {
+    if (!logRecordScanNext(s.times, &ev)) return false;
+  } else {
+    LogRecord rec = s.rec;
+    bool key;
+    next = decodeLogDelta(p, end, rec, s.periodMs, key);
+    if (!next || (!s.keyed && !key) || !logRecordScanNext(s.times, &rec)) return false;
+    s.rec = rec;
+    s.keyed = true;
+  }
+  size_t n = next - p;
+  s.end += n;
+  s.have -= n;
+  memmove(s.buf, next, s.have);
+  return true;
+}
+
+inline void logDeltaScanFeed(LogDeltaScan &s, const uint8_t *p, size_t n) {
+  for (; n > 0 && !s.done; --n) {
+    s.buf[s.have++] = *p++;
+    if (s.have == sizeof(s.buf)) s.done = !logDeltaScanStep(s);
+  }
+}
+
+inline void logDeltaScanEnd(LogDeltaScan &s) {
+  while (!s.done && s.have > 0) s.done = !logDeltaScanStep(s);
+}
+
+// ==================== LATENCY ====================
+// SD operation times are counted in log2 buckets of microseconds: bucket k
+// holds [2^k, 2^(k+1)) us, bucket 0 also 0 us.
+#define LOG_LAT_WRITE   0   // File.write() of a block, retries included
+#define LOG_LAT_SYNC    1   // File.flush() / close()
+#define LOG_LAT_OPEN    2   // SD.open() of a log
+#define LOG_LAT_MOUNT   3   // SD.begin()
+#define LOG_LAT_HANDOFF 4   // loop() passing a buffer to the writer
+#define LOG_LAT_KINDS   5
+#define LOG_LAT_BUCKETS 23  // the last one takes everything from ~4 s up
+
+inline const char *logLatencyName(uint8_t kind) {
+  static const char *const names[LOG_LAT_KINDS] = {"write", "sync", "open", "mount", "handoff"};
+  return kind < LOG_LAT_KINDS ? names[kind] : "?";
+}
+
+inline uint8_t logLatencyBucket(uint32_t us) {
+  uint8_t k = 0;
+  while (us > 1 && k < LOG_LAT_BUCKETS - 1) { us >>= 1; k++; }
+  return k;
+}
+
+// Largest time bucket k holds
+inline uint32_t logLatencyBucketMicros(uint8_t k) { return (2UL << k) - 1; }
+
+inline uint16_t logLatencyTag(uint8_t kind, uint8_t p50, uint8_t p99) {
+  return (uint16_t)(kind | p50 << 3 | p99 << 8);
+}
+
+// ==================== SEEK INDEX ====================
+// Delta and compressed track logs end with a seek index, written on close:
+// count LogIndexEntry, then a LogIndexFooter as the file's last 16 bytes.
+// An entry gives the time of a block's first sample and the file offset the
+// block starts at, which is a keyframe (delta) or a frame (compressed), so
+// decoding can begin there. Entries are in time order, one per block or per
+// every 2nd, 4th... block in long files. Track data ends at dataEnd.
+#define LOG_INDEX_MAGIC "MLX1"
+
+struct __attribute__((packed)) LogIndexEntry {
+  uint32_t time;       // seconds since 2000, as LogRecord.time
+  uint32_t offset;
+};
+
+struct __attribute__((packed)) LogIndexFooter {
+  char magic[4];       // LOG_INDEX_MAGIC
+  uint32_t count;
+  uint32_t dataEnd;    // where the entries start
+  uint32_t crc;        // crc32Update(0, ...) of the entries
+};
+static_assert(sizeof(LogIndexEntry) == 8 && sizeof(LogIndexFooter) == 16, "seek index layout is part of the file format");
+
+// Whether the last 16 bytes of a fileSize-byte log close a seek index; the
+// entries still have to match crc.
+inline bool logIndexFooterValid(const LogIndexFooter &f, size_t fileSize) {
+  return memcmp(f.magic, LOG_INDEX_MAGIC, 4) == 0 && f.dataEnd <= fileSize &&
+         fileSize - f.dataEnd == (size_t)f.count * sizeof(LogIndexEntry) + sizeof(f);
+}
+
+// ==================== DATE HELPERS ====================
+// Days since 2000-01-01 for a proleptic Gregorian date (Hinnant's days_from_civil)
+inline int32_t daysSince2000(int y, int m, int d) {
+  y -= m <= 2;
+  int32_t era = (y >= 0 ? y : y - 399) / 400;
+  int32_t yoe = y - era * 400;
+  int32_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  int32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 730425;
+}
+
+// Inverse of daysSince2000() (Hinnant's civil_from_days)
+inline void civilFromDays2000(int32_t days, int &y, int &m, int &d) {
+  int32_t z = days + 730425;
+  int32_t era = (z >= 0 ? z : z - 146096) / 146097;
+  int32_t doe = z - era * 146097;
+  int32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  int32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  int32_t mp = (5 * doy + 2) / 153;
+  d = doy - (153 * mp + 2) / 5 + 1;
+  m = mp < 10 ? mp + 3 : mp - 9;
+  y = yoe + era * 400 + (m <= 2);
+}
+
+// ==================== FILE NAMES ====================
+// Logs are /LYYMMDDxx.* (pulse logs /R...). The daily index xx runs 00..99,
+// then A0..ZZ (letter, then 0-9A-Z), so names keep their length and still
+// sort in creation order.
+#define LOG_INDEX_DIGITS "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+#define LOG_INDEX_MAX (100 + 26 * 36 - 1) // ZZ: 1036 files per day
+
+inline void formatLogIndex(char *out, int i) {
+  if (i < 100) { out[0] = '0' + i / 10; out[1] = '0' + i % 10; }
+  else { out[0] = 'A' + (i - 100) / 36; out[1] = LOG_INDEX_DIGITS[(i - 100) % 36]; }
+}
+
+// Date (YYMMDD as a number) and index of a /[LR]YYMMDDxx.* name; false for other files.
+inline bool parseLogName(const char *path, uint32_t &date, int &index) {
+  static const char digits[] = LOG_INDEX_DIGITS;
+  if (path[0] == '/') path++;
+  if (strlen(path) < 10 || (path[0] != 'L' && path[0] != 'R') || path[9] != '.') return false;
+  date = 0;
+  for (int i = 1; i <= 6; ++i) {
+    if (path[i] < '0' || path[i] > '9') return false;
+    date = date * 10 + (path[i] - '0');
+  }
+  const char *d1 = strchr(digits, path[8]);
+  if (!d1 || !*d1) return false;
+  if (path[7] >= '0' && path[7] <= '9' && d1 - digits < 10) index = (path[7] - '0') * 10 + (d1 - digits);
+  else if (path[7] >= 'A' && path[7] <= 'Z') index = 100 + (path[7] - 'A') * 36 + (d1 - digits);
+  else return false;
+  return true;
+}
+
+// ==================== DISTANCE ====================
+// Metres between two nearby fixes (degrees x 1e7). Equirectangular, which is
+// well within GPS noise at the few metres between samples.
+inline float logStepMetres(int32_t lat1, int32_t lon1, int32_t lat2, int32_t lon2) {
+  const float radPerE7 = 3.14159265f / 1.8e9f;
+  int64_t dLon = (int64_t)lon2 - lon1;
+  if (dLon > 1800000000LL) dLon -= 3600000000LL;
+  else if (dLon < -1800000000LL) dLon += 3600000000LL;
+  float x = (float)dLon * radPerE7 * cosf(((float)lat1 + (float)lat2) * 0.5f * radPerE7);
+  float y = (float)((int64_t)lat2 - lat1) * radPerE7;
+  return 6371000.0f * sqrtf(x * x + y * y);
+}
+
+// ==================== CSV LINE FORMATTER ====================
+// Same fields as TinyGPSPlus' RawDegrees: value = deg + billionths / 1e9
+struct LogDegrees {
+  uint16_t deg;
+  uint32_t billionths;
+  bool negative;
+};
+
+// Inputs of one "lat,lon,speed_mph,UTC_datetime,RPM" line; invalid GPS fields
+// are passed as zeros (speedMph as -1), matching what the sketch has always logged.
+// millisecond < 0 omits the ".mmm" suffix (1 Hz logs keep whole seconds).
+struct LogLineFields {
+  bool locationValid;
+  LogDegrees lat, lon;
+  int speedMph;
+  int year, month, day;
+  int hour, minute, second;
+  int millisecond;
+  int rpm;
+};
+
+inline LogDegrees logDegreesFromE7(int32_t e7) {
+  uint32_t a = e7 < 0 ? 0u - (uint32_t)e7 : (uint32_t)e7;
+  return LogDegrees{(uint16_t)(a / 10000000u), (a % 10000000u) * 100u, e7 < 0};
+}
+
+// Fields for a CSV line rebuilt from a LogRecord
+inline void logLineFieldsFromRecord(LogLineFields &f, const LogRecord &r, bool subSecond) {
+  f.locationValid = r.flags & LOG_REC_LOCATION_VALID;
+  f.lat = logDegreesFromE7(r.latE7);
+  f.lon = logDegreesFromE7(r.lonE7);
+  f.speedMph = (r.flags & LOG_REC_SPEED_VALID) ? r.speedMph : -1;
+  f.year = f.month = f.day = f.hour = f.minute = f.second = 0;
+  if (r.flags & LOG_REC_DATE_VALID) civilFromDays2000(r.time / 86400, f.year, f.month, f.day);
+  if (r.flags & LOG_REC_TIME_VALID) {
+    uint32_t secs = r.time % 86400;
+    f.hour = secs / 3600; f.minute = (secs / 60) % 60; f.second = secs % 60;
+  }
+  f.millisecond = subSecond ? r.millis % 1000 : -1;
+  f.rpm = r.rpm;
+}
+
+// An event as a LOG_LINE_SIZE CSV line the viewer skips, padded like a
+// journal trailer: "#L,2025-06-14 13:45:09.100,<a>,<b>,<c>" for LOG_EVENT_LOSS,
+// "#C,2025-06-14 13:45:09.100,L25061400" for LOG_EVENT_CONTINUES. Tags run
+// L C S T V B M W H in LOG_EVENT_* order; BOUNDS a and b are signed.
+inline void formatLogEventLine(char *out, const LogEventRecord &ev, bool subSecond) {
+  int y = 0, mo = 0, d = 0;
+  if (ev.flags & LOG_REC_DATE_VALID) civilFromDays2000(ev.time / 86400, y, mo, d);
+  uint32_t secs = (ev.flags & LOG_REC_TIME_VALID) ? ev.time % 86400 : 0;
+  char ms[8] = "";
+  if (subSecond) snprintf(ms, sizeof(ms), ".%03u", (unsigned)(ev.millis % 1000));
+  int len = snprintf(out, LOG_JOURNAL_LINE_SIZE, "#%c,%04d-%02d-%02d %02lu:%02lu:%02lu%s,",
+                     ev.type >= LOG_EVENT_LOSS && ev.type <= LOG_EVENT_LATENCY ? "LCSTVBMWH"[ev.type - 1] : 'E', y, mo, d,
+                     (unsigned long)(secs / 3600), (unsigned long)(secs / 60 % 60), (unsigned long)(secs % 60), ms);
+  if (ev.type == LOG_EVENT_CONTINUES) {
+    len += snprintf(out + len, LOG_JOURNAL_LINE_SIZE - len, "L%06lu", (unsigned long)(ev.a % 1000000));
+    formatLogIndex(out + len, ev.c);
+    len += 2;
+  } else if (ev.type == LOG_EVENT_LATENCY) {
+    // "#H,<time>,<LOG_LAT_*>,<operations>,<p50 us>,<p99 us>,<max us>", percentiles as bucket upper bounds
+    len += snprintf(out + len, LOG_JOURNAL_LINE_SIZE - len, "%u,%lu,%lu,%lu,%lu", (unsigned)(ev.c & 7),
+                    (unsigned long)ev.a, (unsigned long)logLatencyBucketMicros(ev.c >> 3 & 31),
+                    (unsigned long)logLatencyBucketMicros(ev.c >> 8 & 31), (unsigned long)ev.b);
+  } else if (ev.type == LOG_EVENT_BOUNDS) {
+    len += snprintf(out + len, LOG_JOURNAL_LINE_SIZE - len, "%ld,%ld,%u",
+                    (long)(int32_t)ev.a, (long)(int32_t)ev.b, (unsigned)ev.c);
+  } else {
+    len += snprintf(out + len, LOG_JOURNAL_LINE_SIZE - len, "%lu,%lu,%u",
+                    (unsigned long)ev.a, (unsigned long)ev.b, (unsigned)ev.c);
+  }
+  if (len > LOG_JOURNAL_LINE_SIZE - 1) len = LOG_JOURNAL_LINE_SIZE - 1;
+  memset(out + len, ' ', LOG_JOURNAL_LINE_SIZE - len);
+  out[LOG_JOURNAL_LINE_SIZE - 1] = '\n';
+}
+
+// TinyGPSPlus speed.mph() rounded like (int)(mph + 0.5), from speed.value() (knots * 100)
+inline int mphFromKnotsX100(int32_t knotsX100) {
+  return (int)(((int64_t)knotsX100 * 115077945LL + 5000000000LL) / 10000000000LL);
+}
+
+// Writes v with at least minDigits digits (zero padded), returns the end.
+inline char *formatLogUint(char *p, uint32_t v, int minDigits) {
+  char tmp[10];
+  int n = 0;
+  do { tmp[n++] = '0' + v % 10; v /= 10; } while (v);
+  while (n < minDigits) tmp[n++] = '0';
+  while (n) *p++ = tmp[--n];
+  return p;
+}
+
+inline char *formatLogInt(char *p, int v, int minDigits) {
+  if (v < 0) { *p++ = '-'; return formatLogUint(p, 0u - (uint32_t)v, minDigits); }
+  return formatLogUint(p, v, minDigits);
+}
+
+// "%.6f" of deg + billionths / 1e9. An exact half (billionths ending in 500)
+// rounds by the binary double printf would see, so that one case defers to it.
+inline char *formatLogDegrees(char *p, const LogDegrees &d) {
+  uint32_t rem = d.billionths % 1000;
+  if (rem == 500) {
+    double v = d.deg + d.billionths / 1000000000.0;
+    return p + sprintf(p, "%.6f", d.negative ? -v : v);
+  }
+  uint32_t deg = d.deg;
+  uint32_t micro = d.billionths / 1000 + (rem > 500);
+  if (micro >= 1000000) { micro -= 1000000; deg++; }
+  if (d.negative) *p++ = '-';
+  p = formatLogUint(p, deg, 1);
+  *p++ = '.';
+  return formatLogUint(p, micro, 6);
+}
+
+// Byte-identical to
+//   snprintf(out, ..., "%.6f,%.6f,%d,%04d-%02d-%02d %02d:%02d:%02d,%d\n", ...)
+// for the values TinyGPSPlus produces (with ".%03d" after the seconds when
+// millisecond >= 0). out needs room for 80 bytes; returns the length.
+inline int formatLogLine(char *out, const LogLineFields &f) {
+  static const LogDegrees zero = {0, 0, false};
+  char *p = out;
+  p = formatLogDegrees(p, f.locationValid ? f.lat : zero); *p++ = ',';
+  p = formatLogDegrees(p, f.locationValid ? f.lon : zero); *p++ = ',';
+  p = formatLogInt(p, f.speedMph, 1); *p++ = ',';
+  p = formatLogInt(p, f.year, 4); *p++ = '-';
+  p = formatLogInt(p, f.month, 2); *p++ = '-';
+  p = formatLogInt(p, f.day, 2); *p++ = ' ';
+  p = formatLogInt(p, f.hour, 2); *p++ = ':';
+  p = formatLogInt(p, f.minute, 2); *p++ = ':';
+  p = formatLogInt(p, f.second, 2);
+  if (f.millisecond >= 0) { *p++ = '.'; p = formatLogInt(p, f.millisecond, 3); }
+  *p++ = ',';
+  p = formatLogInt(p, f.rpm, 1); *p++ = '\n';
+  return p - out;
+}
+
+#endif
@@ -0,0 +1,1198 @@
+/*
+  Mini Logger - Host Tests
+  - Builds the sketch against the stand-ins in host/: Arduino core, FreeRTOS
+    (the SD writer task is a real thread), in-memory SD cards with slow,
+    failing or pulled writes, and a TinyGPSPlus fed whole fixes
+  - Drives setup() and loop() on a clock running sim::scale times faster than
+    the wall clock, then reads back what reached the card
+  - Each test runs in its own process, so the sketch's globals start fresh;
+    LOG_TEST_VERBOSE=1 echoes the sketch's Serial output
+  - Log-decoder.cpp is built in (namespace decoder) to read back binary,
+    compressed and pulse logs
+  - Tests of one build option are compiled only with it, so the suite is run
+    per variant: -DPULSE_LOG=1, -DLOG_FORMAT=LOG_FORMAT_BINARY, -DLOG_RATE_HZ=1, ...
+  - A change to the sketch or the decoder adds its tests here in the same
+    commit, under the section of the code they cover
+
+  Build: g++ -std=c++17 -O2 -pthread -Ihost -o log-test Log-test.cpp
+  Usage: log-test            runs every test
+         log-test slow-sd    runs the tests whose name contains "slow-sd"
+*/
+
+#include <Arduino.h>
+#include <Wire.h>
+#include <SPI.h>
+#include <SD.h>
+#include <Preferences.h>
+#include <HardwareSerial.h>
+#include <TinyGPSPlus.h>
+#include <Adafruit_SH110X.h>
+#include <algorithm>
+#include <functional>
+#include <sys/wait.h>
+#include <unistd.h>
+#define truncate simTruncate // the sketch trims logs through the VFS path
+#include "Esp32-c3-supermini.cpp"
+#undef truncate
+namespace decoder {
+#include "Log-decoder.cpp"
+}
+
+// ==================== HARNESS ====================
+bool testFailed = false;
+
+// Most tests read the track back as journaled CSV lines
+#define CSV_TRACK (LOG_FORMAT == LOG_FORMAT_CSV && !LOG_COMPRESS)
+
+#define CHECK(cond, ...) do {                                        \
+    if (!(cond)) {                                                   \
+      testFailed = true;                                             \
+      fprintf(stderr, "  %s:%d: check failed: %s: ", __FILE__, __LINE__, #cond); \
+      fprintf(stderr, __VA_ARGS__);                                  \
+      fputc('\n', stderr);                                           \
+    }                                                                \
+  } while (0)
+
+// 1 Hz fixes for a car heading north at ~25 mph. Fix k is for the GPS second
+// startSecond + k (seconds since 2000) and arrives lagMs(k) after its epoch.
+struct GpsFeed {
+  int64_t startSecond = (int64_t)daysSince2000(2025, 6, 14) * 86400 + 13 * 3600 + 45 * 60;
+  unsigned long epochMillis = 0;          // millis() at the epoch of fix 0
+  int64_t sent = 0;
+  std::function<long(int64_t)> lagMs = [](int64_t) { return 80L; };
+  bool on = true;
+
+  void poll() {
+    while (on && millis() >= epochMillis + sent * 1000 + lagMs(sent)) {
+      int64_t s = startSecond + sent;
+      int y, mo, d;
+      civilFromDays2000((int32_t)(s / 86400), y, mo, d);
+      uint32_t sod = (uint32_t)(s % 86400);
+      sim::GpsFix fix = {(uint16_t)y, (uint8_t)mo, (uint8_t)d, (uint8_t)(sod / 3600), (uint8_t)(sod / 60 % 60),
+                         (uint8_t)(sod % 60), 0, 407128000 + (int32_t)sent * 1000, -740060000, 2160, 8};
+      gps.pending.push_back(fix);
+      gpsSerial.rx += '\n';
+      sent++;
+    }
+  }
+
+  // GPS time (ms since 2000) of the moment millis() reads m
+  int64_t gpsMsAt(unsigned long m) const { return startSecond * 1000 + (int64_t)(m - epochMillis); }
+};
+GpsFeed feed;
+
+void step() {
+  feed.poll();
+  loop();
+  sim::sleepMs(1);
+}
+
+void runFor(unsigned long ms) {
+  unsigned long end = millis() + ms;
+  while (millis() < end) step();
+}
+
+bool runUntil(const std::function<bool()> &done, unsigned long timeoutMs) {
+  unsigned long end = millis() + timeoutMs;
+  while (!done()) {
+    if (millis() >= end) return false;
+    step();
+  }
+  return true;
+}
+
+std::shared_ptr<sim::Card> newCard(uint32_t seed = 1) { return std::make_shared<sim::Card>(seed); }
+
+// Powers up with card in the slot and the first fix on its way
+void boot(std::shared_ptr<sim::Card> card) {
+  sim::insert(card);
+  feed.epochMillis = millis();
+  setup();
+}
+
+// A short press of the button, as handleButton() reports it
+void click() {
+  buttonJustClicked = true;
+  step();
+}
+
+// Runs until the writer has handed back every buffer
+bool waitWriterIdle(unsigned long timeoutMs = 60000) {
+  unsigned long end = millis() + timeoutMs;
+  while (!logWriterIdle()) {
+    if (millis() >= end) return false;
+    sim::sleepMs(1);
+  }
+  return true;
+}
+
+std::string newestLog(const std::shared_ptr<sim::Card> &card) {
+  std::lock_guard<std::recursive_mutex> l(sim::fsMutex);
+  std::string newest;
+  for (auto &kv : card->files)
+    if (kv.first.compare(0, 2, "/L") == 0 && kv.first > newest) newest = kv.first;
+  return newest;
+}
+
+// A CSV log read back line by line, padding stripped
+struct CsvLog {
+  std::vector<uint8_t> bytes;
+  std::vector<std::string> lines;
+  std::vector<int64_t> samples;           // ms since 2000 of each sample line
+  std::vector<std::string> events;        // "#X,..." lines other than #J
+};
+
+bool parseSampleTime(const std::string &line, int64_t &ms) {
+  int y, mo, d, h, mi, s, milli = 0;
+  if (sscanf(line.c_str(), "%*[^,],%*[^,],%*[^,],%d-%d-%d %d:%d:%d.%d", &y, &mo, &d, &h, &mi, &s, &milli) < 6) return false;
+  ms = (((int64_t)daysSince2000(y, mo, d) * 24 + h) * 60 + mi) * 60000 + s * 1000 + milli;
+  return true;
+}
+
+CsvLog readCsvLog(const std::vector<uint8_t> &bytes) {
+  CsvLog log;
+  log.bytes = bytes;
+  std::string text(bytes.begin(), bytes.end()), line;
+  for (size_t i = 0; i <= text.size(); ++i) {
+    if (i < text.size() && text[i] != '\n') { line += text[i]; continue; }
+    size_t a = line.find_first_not_of(" \r"), b = line.find_last_not_of(" \r");
+    line = a == std::string::npos ? "" : line.substr(a, b - a + 1);
+    if (!line.empty()) {
+      log.lines.push_back(line);
+      int64_t ms;
+      if (line[0] == '#') { if (line.compare(0, 2, "#J") != 0) log.events.push_back(line); }
+      else if (parseSampleTime(line, ms)) log.samples.push_back(ms);
+    }
+    line.clear();
+  }
+  return log;
+}
+
+CsvLog readCsvLog(const std::shared_ptr<sim::Card> &card, const std::string &path) {
+  return readCsvLog(sim::fileBytes(card, path));
+}
+
+// Log-decoder's output for a file's bytes; decode is one of its entry points
+// (decoder::decodeFile, decodeRange, ...), and rc gets what it returned.
+std::string decodeBytes(const std::vector<uint8_t> &bytes, const std::function<int(FILE*, FILE*)> &decode, int &rc) {
+  FILE *in = tmpfile(), *out = tmpfile();
+  fwrite(bytes.data(), 1, bytes.size(), in);
+  rewind(in);
+  rc = decode(in, out);
+  rewind(out);
+  std::string text;
+  char chunk[4096];
+  for (size_t n; (n = fread(chunk, 1, sizeof(chunk), out)) > 0;) text.append(chunk, n);
+  fclose(in);
+  fclose(out);
+  return text;
+}
+
+// Field n of the last event line with this tag (0 = its time, 1 = a), or -1
+long long eventField(const CsvLog &log, char tag, int n) {
+  for (size_t i = log.events.size(); i-- > 0;) {
+    if (log.events[i][1] != tag) continue;
+    std::string rest = log.events[i];
+    for (int k = 0; k < n + 1; ++k) {
+      size_t comma = rest.find(',');
+      if (comma == std::string::npos) return -1;
+      rest = rest.substr(comma + 1);
+    }
+    return atoll(rest.c_str());
+  }
+  return -1;
+}
+
+// Journal check of a whole CSV log: every byte belongs to an intact block
+bool journalIntact(const CsvLog &log, LogJournalScan &j) {
+  logJournalFeed(j, log.bytes.data(), log.bytes.size());
+  return j.blocks > 0 && j.end == log.bytes.size();
+}
+
+bool strictlyIncreasing(const std::vector<int64_t> &v) {
+  for (size_t i = 1; i < v.size(); ++i) if (v[i] <= v[i - 1]) return false;
+  return true;
+}
+
+// ==================== CLOSE AND WRITE FAILURES ====================
+#if CSV_TRACK
+// Stopping while the writer holds both track buffers on a slow card: the last
+// partial buffer and the footer still reach the file, nothing is dropped.
+void testSlowSdClose() {
+  auto card = newCard();
+  boot(card);
+  runFor(3000);
+  click();
+  CHECK(isLogging, "logging did not start");
+  std::string track = trackFileName; // the writer moves gpsLog.fileName on to the next log after the stop
+  card->writeMs = [](size_t) { return 20000.0; }; // every write() stalls for 20 s
+  // One buffer stuck at the writer, the other full, samples parked in RAM
+  CHECK(runUntil([] { return trackOverflowCount > 20; }, 120000), "the track never overflowed");
+  CHECK(uxQueueMessagesWaiting(gpsLog.freeQueue) == 0, "a buffer came back before the click");
+  unsigned long stopMillis = millis();
+  lastToggleMillis = 0;
+  click();
+  CHECK(!isLogging, "logging did not stop");
+  CHECK(logWriterIdle(), "close returned with buffers still at the writer");
+
+  CsvLog log = readCsvLog(card, track);
+  LogJournalScan j;
+  CHECK(journalIntact(log, j), "journal ends at %zu of %zu bytes", j.end, log.bytes.size());
+  CHECK(eventField(log, 'T', 1) == (long long)log.samples.size(), "footer counts %lld samples, file has %zu",
+        eventField(log, 'T', 1), log.samples.size());
+  CHECK(trackDropped == 0, "%lu samples dropped", (unsigned long)trackDropped);
+  CHECK(strictlyIncreasing(log.samples), "sample times go backwards");
+  int64_t slots = log.samples.empty() ? 0 : (feed.gpsMsAt(stopMillis) - log.samples.front()) / LOG_SAMPLE_PERIOD_MS;
+  CHECK(log.samples.size() * 100 >= (size_t)slots * 95, "%zu samples over %lld slots", log.samples.size(), (long long)slots);
+  printf("  %zu samples, %lu overflow peak, %zu bytes\n", log.samples.size(), (unsigned long)trackOverflowPeak,
+         log.bytes.size());
+}
+
+// A card that stops taking writes but still answers: the session ends, the
+// file is closed and trimmed, and the next click starts a new one.
+void testWriteFailureCloses() {
+  auto card = newCard();
+  boot(card);
+  runFor(3000);
+  click();
+  CHECK(isLogging, "logging did not start");
+  runFor(12000);
+  std::string first = trackFileName;
+  card->failWrites = true;
+  CHECK(runUntil([] { return !isLogging; }, 60000), "a failing card did not end the session");
+  CHECK(bottomMessage == "SD Write Error", "message is \"%s\"", bottomMessage.c_str());
+  CHECK(!gpsLog.file, "log file left open");
+  CHECK(logWriterIdle(), "buffers left at the writer");
+  CsvLog log = readCsvLog(card, first);
+  LogJournalScan j;
+  CHECK(journalIntact(log, j), "journal ends at %zu of %zu bytes", j.end, log.bytes.size());
+  CHECK(log.samples.size() > 0, "nothing reached the card before the failure");
+
+  card->failWrites = false;
+  runFor(6000);
+  click();
+  std::string second = trackFileName;
+  CHECK(isLogging && second != first, "no new session after the failure");
+  runFor(12000);
+  lastToggleMillis = 0;
+  click();
+  CHECK(readCsvLog(card, second).samples.size() > 0, "new session logged nothing");
+}
+
+// A block that fails while it is shorter than a sector: its lines only ever
+// sat in the sector tail, and close must cut the file where the last block
+// that reached the card ended, not past them.
+void testFailedShortBlock() {
+  auto card = newCard();
+  boot(card);
+  runFor(3000);
+  click();
+  CHECK(isLogging, "logging did not start");
+  std::string track = trackFileName;
+  CHECK(runUntil([] { return sdLatencyWindow[LOG_LAT_WRITE].total > 0 && logWriterIdle() && gpsLog.fillBytes > 0 &&
+                             gpsLog.fillBytes <= 4 * LOG_RECORD_SIZE; }, 30000),
+        "no short block after a written one");
+  size_t written;
+  {
+    std::lock_guard<std::recursive_mutex> l(sim::fsMutex);
+    written = gpsLog.dataEnd;
+  }
+  card->failWrites = true;
+  handOffLogStream(gpsLog, FLUSH_IDLE);
+  CHECK(runUntil([] { return !isLogging; }, 60000), "a failing card did not end the session");
+  card->failWrites = false;
+
+  CsvLog log = readCsvLog(card, track);
+  LogJournalScan j;
+  CHECK(journalIntact(log, j), "journal ends at %zu of %zu bytes", j.end, log.bytes.size());
+  CHECK(log.bytes.size() == written, "closed at %zu bytes, %zu were written before the failure", log.bytes.size(),
+        written);
+  printf("  closed at %zu bytes, the last block that reached the card\n", log.bytes.size());
+}
+#endif
+
+// ==================== SAMPLE CLOCK ====================
+#if CSV_TRACK
+// Fixes arrive 50-450 ms after their epoch, the way NMEA bursts jitter with
+// load on the receiver. Each one re-anchors the clock, sometimes backwards;
+// sample times must still only go forward, and few slots may be skipped.
+void testJitteredFixes() {
+  uint32_t seed = 12345;
+  std::vector<long> lags(400);
+  for (long &lag : lags) { seed = seed * 1103515245 + 12345; lag = 50 + (long)(seed >> 16) % 400; }
+  feed.lagMs = [lags](int64_t k) { return lags[k % lags.size()]; };
+  auto card = newCard();
+  boot(card);
+  runFor(3000);
+  click();
+  CHECK(isLogging, "logging did not start");
+  std::string track = trackFileName;
+  runFor(60000);
+  unsigned long stopMillis = millis();
+  lastToggleMillis = 0;
+  click();
+  CsvLog log = readCsvLog(card, track);
+  CHECK(!log.samples.empty(), "nothing logged");
+  size_t back = 0;
+  for (size_t i = 1; i < log.samples.size(); ++i) if (log.samples[i] <= log.samples[i - 1]) back++;
+  CHECK(back == 0, "%zu of %zu samples do not move forward", back, log.samples.size());
+  int64_t slots = log.samples.empty() ? 0 : (feed.gpsMsAt(stopMillis) - log.samples.front()) / LOG_SAMPLE_PERIOD_MS;
+  CHECK(log.samples.size() * 100 >= (size_t)slots * 90, "%zu samples over %lld slots", log.samples.size(),
+        (long long)slots);
+  LogJournalScan j;
+  CHECK(journalIntact(log, j), "journal ends at %zu of %zu bytes", j.end, log.bytes.size());
+  printf("  %zu samples over %lld slots\n", log.samples.size(), (long long)slots);
+}
+#endif
+
+// ==================== RPM ====================
+// Puts hall edges in the pulse ring as hallISR() stamps them: periods apart,
+// oldest first, the last one lastAgoUs before now.
+void feedPulses(const std::vector<uint32_t> &periods, uint32_t lastAgoUs) {
+  uint32_t t = micros() - lastAgoUs;
+  for (uint32_t p : periods) t -= p;
+  for (size_t i = 0; i <= periods.size(); ++i) {
+    pulseTimes[pulseHead & (RPM_RING_SIZE - 1)] = t;
+    pulseHead++;
+    if (i < periods.size()) t += periods[i];
+  }
+}
+
+// RPM from the reading loop() would take now, with the train started afresh
+int rpmAfter(const std::vector<uint32_t> &periods, uint32_t lastAgoUs) {
+  havePulse = false;
+  resetPulsePeriods();
+  feedPulses(periods, lastAgoUs);
+  updateRPM();
+  return RPM;
+}
+
+uint32_t periodAt(int rpm) { return 60000000UL / PULSES_PER_REV / rpm; }
+int rpmOf(uint32_t period) { return (int)(60000000UL / PULSES_PER_REV / period) / 10 * 10; }
+
+// Synthetic edge trains: the RPM of a steady train to the 10 RPM shown, the
+// mean of the last RPM_AVG_PULSES periods only, no switch to the elapsed
+// time for a pulse that is merely late, and 0 after RPM_TIMEOUT_US.
+void testRpmFromPulses() {
+  for (int rpm : {300, 1230, 3000, 7770, 12340}) {
+    uint32_t p = periodAt(rpm);
+    int got = rpmAfter(std::vector<uint32_t>(10, p), p / 2);
+    CHECK(got == rpmOf(p), "%d RPM read as %d", rpm, got);
+  }
+  // Alternating periods average out; older, slower ones have left the window
+  std::vector<uint32_t> train(20, periodAt(1500));
+  for (int i = 0; i < RPM_AVG_PULSES; ++i) train.push_back(i % 2 ? 9000 : 11000);
+  int got = rpmAfter(train, 5000);
+  CHECK(got == rpmOf(10000), "mean of the last %d periods read as %d RPM", RPM_AVG_PULSES, got);
+
+  // Late by less than half a period is jitter; more is the engine slowing
+  uint32_t p = periodAt(3000);
+  std::vector<uint32_t> steady(10, p);
+  got = rpmAfter(steady, p + p / 4);
+  CHECK(got == 3000, "a pulse %u us late read as %d RPM", p / 4, got);
+  got = rpmAfter(steady, 2 * p);   // the clock moves on a little before the read
+  CHECK(got <= rpmOf(2 * p) && got >= rpmOf(2 * p) - 10, "a missing pulse read as %d RPM, want %d", got,
+        rpmOf(2 * p));
+  got = rpmAfter(steady, RPM_TIMEOUT_US + p);
+  CHECK(got == 0, "%d RPM %lu us after the last pulse", got, (unsigned long)(RPM_TIMEOUT_US + p));
+
+  // The reading decays as the gap grows, and only once the timeout reads 0
+  got = rpmAfter(steady, p / 2);
+  int last = got;
+  bool falling = true;
+  for (uint32_t ago = 2 * p; ago < RPM_TIMEOUT_US; ago += 20000) {
+    havePulse = true;
+    lastPulseMicros = micros() - ago;
+    updateRPM();
+    if (RPM > last || RPM == 0) falling = false;
+    last = RPM;
+  }
+  CHECK(falling, "RPM did not fall steadily while the pulses stopped");
+  lastPulseMicros = micros() - RPM_TIMEOUT_US - 1000;
+  updateRPM();
+  CHECK(RPM == 0, "%d RPM past RPM_TIMEOUT_US", RPM);
+  printf("  3000 RPM train: %d RPM with a pulse missing, %d RPM just before the %lu ms timeout\n",
+         rpmAfter(steady, 2 * p), last, RPM_TIMEOUT_US / 1000);
+}
+
+// ==================== RECORD SCAN ====================
+const uint8_t SAMPLE_FLAGS = LOG_REC_LOCATION_VALID | LOG_REC_SPEED_VALID | LOG_REC_DATE_VALID | LOG_REC_TIME_VALID;
+
+LogRecord sampleAt(int64_t ms, int32_t latE7 = 407128000) {
+  return LogRecord{latE7, -740060000, (uint32_t)(ms / 1000), 1200, 25, SAMPLE_FLAGS, (uint16_t)(ms % 1000)};
+}
+
+LogRecord eventSlot(uint8_t type, int64_t ms) {
+  LogEventRecord ev = logEventAt(type, 1, 2, 3, sampleAt(ms));
+  LogRecord r;
+  memcpy(&r, &ev, sizeof(r));
+  return r;
+}
+
+// Records kept by a scan of slots, as findLogDataEnd() walks a binary log
+size_t scanSlots(const std::vector<LogRecord> &slots, LogRecordScan &rs) {
+  size_t n = 0;
+  while (n < slots.size() && logRecordScanNext(rs, &slots[n])) n++;
+  return n;
+}
+
+// A binary log cut short in its pre-allocated space, over an older log: the
+// older records are plausible one by one but are not counted as this file's.
+void testBinaryScanStopsAtStaleTail() {
+  int64_t t0 = feed.startSecond * 1000;
+  std::vector<LogRecord> slots = {eventSlot(LOG_EVENT_SESSION, t0)};
+  for (int i = 0; i < 300; ++i) {
+    slots.push_back(sampleAt(t0 + i * 100));
+    if (i == 150) slots.push_back(eventSlot(LOG_EVENT_MARKER, t0 + 120 * 100)); // a lap, stamped at the press
+    if (i == 200) slots.push_back(eventSlot(LOG_EVENT_LOSS, t0 + i * 100));
+  }
+  size_t real = slots.size();
+  struct Tail { const char *what; int64_t startMs; };
+  const Tail tails[] = {
+    {"earlier the same day", t0 - 3600 * 1000},
+    {"a day before", t0 - 86400 * 1000},
+    {"two minutes on", t0 + 300 * 100 + 120 * 1000},
+  };
+  for (const Tail &t : tails) {
+    std::vector<LogRecord> file = slots;
+    file.push_back(eventSlot(LOG_EVENT_SESSION, t.startMs));
+    for (int i = 0; i < 500; ++i) file.push_back(sampleAt(t.startMs + i * 100));
+    LogRecordScan rs;
+    size_t kept = scanSlots(file, rs);
+    CHECK(kept == real && rs.records == 300, "older log %s: kept %zu of %zu slots, %u samples", t.what, kept, real,
+          (unsigned)rs.records);
+    // The same older log with no samples before it: only the header is the file's
+    std::vector<LogRecord> empty = {slots[0]};
+    for (int i = 0; i < 500; ++i) empty.push_back(sampleAt(t.startMs + i * 100));
+    LogRecordScan es;
+    kept = scanSlots(empty, es);
+    CHECK(kept == 1 && es.records == 0, "older log %s after a bare header: kept %zu slots", t.what, kept);
+  }
+
+  // A 30 s hole in the fixes is still one drive
+  std::vector<LogRecord> gap = slots;
+  for (int i = 0; i < 100; ++i) gap.push_back(sampleAt(t0 + 300 * 100 + 30000 + i * 100));
+  LogRecordScan gs;
+  CHECK(scanSlots(gap, gs) == gap.size(), "a 30 s gap cut the log at %u samples", (unsigned)gs.records);
+  // Zeroed or erased space ends it too
+  std::vector<LogRecord> blank = slots;
+  LogRecord zero = {}, erased;
+  memset(&erased, 0xFF, sizeof(erased));
+  blank.push_back(zero);
+  LogRecordScan bs;
+  CHECK(scanSlots(blank, bs) == real, "zeroed slot kept");
+  blank.back() = erased;
+  LogRecordScan fs;
+  CHECK(scanSlots(blank, fs) == real, "erased slot kept");
+}
+
+// ==================== DELTA TRACKS ====================
+// A synthetic 10 Hz drive: speed and rpm wander, the odd sample is late, and
+// every LOG_KEYFRAME_SECONDS starts with a full record, as appendTrackSample()
+// writes them. Events go in between samples.
+struct DeltaTrack {
+  std::vector<LogRecord> samples;
+  std::vector<size_t> starts;     // body offset of each record, events included
+  std::vector<uint8_t> body;
+};
+
+DeltaTrack makeDeltaTrack(int64_t t0, int n, uint32_t seed) {
+  DeltaTrack t;
+  LogRecord prev = {};
+  int64_t ms = t0;
+  int32_t lat = 407128000, lon = -740060000;
+  int speed = 20, rpm = 2400;
+  for (int i = 0; i < n; ++i) {
+    seed = seed * 1103515245 + 12345;
+    ms += LOG_SAMPLE_PERIOD_MS + ((seed >> 8) % 16 == 0 ? (seed >> 12) % 40 : 0);
+    speed += (int)((seed >> 16) % 3) - 1;
+    rpm += (int)((seed >> 20) % 201) - 100;
+    lat += 100 + speed * 4;
+    lon += (int32_t)((seed >> 4) % 9) - 4;
+    LogRecord rec = sampleAt(ms, lat);
+    rec.lonE7 = lon;
+    rec.speedMph = (uint8_t)(speed < 0 ? 0 : speed);
+    rec.rpm = (uint16_t)(rpm < 0 ? 0 : rpm);
+    if (i % 97 == 50) rec.flags &= ~LOG_REC_SPEED_VALID;
+    uint8_t buf[LOG_DELTA_MAX_BYTES];
+    if (i % 73 == 10) {
+      LogEventRecord ev = logEventAt(LOG_EVENT_MARKER, LOG_MARK_LAP, i, 0, prev);
+      t.starts.push_back(t.body.size());
+      t.body.insert(t.body.end(), buf, buf + encodeLogEvent(buf, ev));
+    }
+    bool key = i % (LOG_KEYFRAME_SECONDS * LOG_RATE_HZ) == 0;
+    t.starts.push_back(t.body.size());
+    t.body.insert(t.body.end(), buf, buf + encodeLogDelta(buf, prev, rec, LOG_SAMPLE_PERIOD_MS, key));
+    t.samples.push_back(rec);
+    prev = rec;
+  }
+  return t;
+}
+
+LogDeltaScan scanDelta(const std::vector<uint8_t> &body, size_t chunk) {
+  LogDeltaScan ds(LOG_SAMPLE_PERIOD_MS);
+  for (size_t at = 0; at < body.size() && !ds.done; at += chunk)
+    logDeltaScanFeed(ds, body.data() + at, std::min(chunk, body.size() - at));
+  logDeltaScanEnd(ds);
+  return ds;
+}
+
+// Every sample decodes back to the record that was encoded, and the file is
+// a fraction of the binary and CSV sizes.
+void testDeltaRoundTrip() {
+  DeltaTrack t = makeDeltaTrack(feed.startSecond * 1000, 500, 7);
+  const uint8_t *p = t.body.data(), *end = p + t.body.size();
+  LogRecord rec = {};
+  size_t n = 0, events = 0, mismatched = 0;
+  while (p < end) {
+    LogEventRecord ev;
+    const uint8_t *next = decodeLogEvent(p, end, ev);
+    if (next) { events++; p = next; continue; }
+    bool key;
+    next = decodeLogDelta(p, end, rec, LOG_SAMPLE_PERIOD_MS, key);
+    if (!next) break;
+    if (n >= t.samples.size() || memcmp(&rec, &t.samples[n], sizeof(rec)) != 0) mismatched++;
+    n++;
+    p = next;
+  }
+  CHECK(p == end, "decoding stopped at %zu of %zu bytes", (size_t)(p - t.body.data()), t.body.size());
+  CHECK(n == t.samples.size() && mismatched == 0, "%zu samples decoded, %zu differ", n, mismatched);
+  CHECK(events == t.starts.size() - t.samples.size(), "%zu events decoded", events);
+  CHECK(t.body.size() * 2 < t.samples.size() * sizeof(LogRecord), "%zu bytes is not half of binary", t.body.size());
+  printf("  %zu samples: delta %zu bytes, binary %zu, CSV %zu\n", t.samples.size(), t.body.size(),
+         t.samples.size() * sizeof(LogRecord), t.samples.size() * (size_t)LOG_LINE_SIZE);
+}
+
+// Recovery of a delta log cut short: a torn last record is dropped, an older
+// log in the pre-allocated space is not read as this one, and how the body is
+// chunked does not matter.
+void testDeltaRecovery() {
+  int64_t t0 = feed.startSecond * 1000;
+  DeltaTrack t = makeDeltaTrack(t0, 500, 7);
+  for (size_t chunk : {(size_t)1, (size_t)7, (size_t)LOG_SECTOR_SIZE}) {
+    LogDeltaScan ds = scanDelta(t.body, chunk);
+    CHECK(ds.end == t.body.size() && ds.times.records == 500, "chunks of %zu: end %zu of %zu, %u samples", chunk,
+          ds.end, t.body.size(), (unsigned)ds.times.records);
+  }
+
+  // Torn last record, cut at every length
+  size_t last = t.starts.back();
+  for (size_t cut = last + 1; cut < t.body.size(); ++cut) {
+    LogDeltaScan ds = scanDelta(std::vector<uint8_t>(t.body.begin(), t.body.begin() + cut), LOG_SECTOR_SIZE);
+    CHECK(ds.end == last && ds.times.records == 499, "cut at %zu: end %zu, %u samples", cut, ds.end,
+          (unsigned)ds.times.records);
+  }
+
+  // An older drive left behind, from its keyframe or from a delta in between
+  DeltaTrack older = makeDeltaTrack(t0 - 3600 * 1000, 500, 99);
+  for (size_t from : {(size_t)0, older.starts[older.starts.size() / 2], older.starts[137]}) {
+    std::vector<uint8_t> file = t.body;
+    file.insert(file.end(), older.body.begin() + from, older.body.end());
+    LogDeltaScan ds = scanDelta(file, LOG_SECTOR_SIZE);
+    // A bare delta reads on from this log's last sample until the older
+    // log's next keyframe goes back in time
+    uint32_t keyframeRun = LOG_KEYFRAME_SECONDS * LOG_RATE_HZ;
+    CHECK(ds.end >= t.body.size() && ds.times.records >= 500 && ds.times.records < 500 + keyframeRun,
+          "older log from %zu: end %zu of %zu, %u samples", from, ds.end, t.body.size(), (unsigned)ds.times.records);
+    if (from == 0) CHECK(ds.end == t.body.size(), "older log from its start: end %zu of %zu", ds.end, t.body.size());
+  }
+
+  // Zeroed and erased space
+  for (uint8_t fill : {(uint8_t)0x00, (uint8_t)0xFF}) {
+    std::vector<uint8_t> file = t.body;
+    file.resize(file.size() + 4096, fill);
+    LogDeltaScan ds = scanDelta(file, LOG_SECTOR_SIZE);
+    CHECK(ds.end == t.body.size(), "0x%02x fill: end %zu of %zu", fill, ds.end, t.body.size());
+  }
+}
+
+// ==================== DECODER ====================
+#if !CSV_TRACK
+// Logs a drive of ms to a fresh card; the track file as it was closed
+std::vector<uint8_t> logDrive(unsigned long ms) {
+  auto card = newCard();
+  boot(card);
+  runFor(3000);
+  click();
+  CHECK(isLogging, "logging did not start");
+  std::string track = trackFileName; // the writer moves gpsLog.fileName on to the next log after the stop
+  runFor(ms);
+  click();
+  CHECK(!isLogging && waitWriterIdle(), "logging did not stop");
+  return sim::fileBytes(card, track);
+}
+
+// Line (of LOG_LINE_SIZE) where two decodes first differ, for the report
+size_t firstDifferingLine(const std::string &a, const std::string &b) {
+  size_t at = std::mismatch(a.begin(), a.begin() + std::min(a.size(), b.size()), b.begin()).first - a.begin();
+  return at / LOG_LINE_SIZE;
+}
+
+// decodeRange() of the window [from, to) must give what a full decode with
+// the same window gives, and hold exactly the full log's samples in it
+void checkRange(const std::vector<uint8_t> &bytes, const CsvLog &whole, uint32_t from, uint32_t to) {
+  int fullRc, rangeRc;
+  decoder::window = {true, from, to};
+  std::string full = decodeBytes(bytes, decoder::decodeFile, fullRc);
+  std::string range = decodeBytes(bytes, decoder::decodeRange, rangeRc);
+  decoder::window = {};
+  CHECK(fullRc == 0 && rangeRc == 0, "-t %lu..%lu: decodeFile returned %d, decodeRange %d", (unsigned long)from,
+        (unsigned long)to, fullRc, rangeRc);
+  CHECK(range == full, "-t %lu..%lu: %zu bytes through the range, %zu from the full decode, line %zu differs",
+        (unsigned long)from, (unsigned long)to, range.size(), full.size(), firstDifferingLine(range, full));
+  std::vector<int64_t> inside;
+  for (int64_t ms : whole.samples)
+    if (ms >= from * 1000LL && ms < to * 1000LL) inside.push_back(ms);
+  CsvLog got = readCsvLog(std::vector<uint8_t>(range.begin(), range.end()));
+  CHECK(!inside.empty() && got.samples == inside, "-t %lu..%lu: %zu samples decoded, %zu in the log",
+        (unsigned long)from, (unsigned long)to, got.samples.size(), inside.size());
+}
+
+int summarize(FILE *in, FILE *out) { return decoder::summarizeFile(in, out) ? 0 : 1; }
+#endif
+
+#if LOG_FORMAT == LOG_FORMAT_BINARY && !LOG_COMPRESS
+// The device CSV for a binary log's records: what the CSV build writes for
+// the same samples and events, column line aside
+std::string deviceCsvOf(const std::vector<uint8_t> &bytes) {
+  std::string csv;
+  for (size_t at = sizeof(LogFileHeader); at + sizeof(LogRecord) <= bytes.size(); at += sizeof(LogRecord)) {
+    LogRecord rec;
+    memcpy(&rec, &bytes[at], sizeof(rec));
+    char line[80];
+    if (isLogEvent(&rec)) {
+      LogEventRecord ev;
+      memcpy(&ev, &rec, sizeof(ev));
+      formatLogEventLine(line, ev, LOG_RATE_HZ > 1);
+    } else {
+      LogLineFields f;
+      logLineFieldsFromRecord(f, rec, LOG_RATE_HZ > 1);
+      int len = formatLogLine(line, f);
+      if (len > LOG_LINE_SIZE) { len = LOG_LINE_SIZE; line[LOG_LINE_SIZE - 1] = '\n'; }
+      memset(line + len, ' ', LOG_LINE_SIZE - len);
+    }
+    csv.append(line, LOG_LINE_SIZE);
+  }
+  return csv;
+}
+
+// A binary log from the device decodes line for line to the device CSV, its
+// footer counts the samples, and the summary and a -t window read it too.
+void testBinaryDecode() {
+  std::vector<uint8_t> bytes = logDrive(60000);
+  CHECK((bytes.size() - sizeof(LogFileHeader)) % sizeof(LogRecord) == 0, "%zu bytes is not whole records",
+        bytes.size());
+  int rc;
+  std::string csv = decodeBytes(bytes, decoder::decodeFile, rc);
+  std::string columns = "lat,lon,speed_mph,UTC_datetime,RPM\n", expected = deviceCsvOf(bytes);
+  CHECK(rc == 0, "the decoder returned %d", rc);
+  CHECK(csv.compare(0, columns.size(), columns) == 0, "no column line");
+  std::string lines = csv.substr(std::min(csv.size(), columns.size()));
+  CHECK(lines == expected, "%zu bytes decoded for %zu of device CSV, line %zu differs", lines.size(), expected.size(),
+        firstDifferingLine(lines, expected));
+  CsvLog log = readCsvLog(std::vector<uint8_t>(csv.begin(), csv.end()));
+  CHECK(log.samples.size() > 50 * LOG_RATE_HZ, "%zu samples", log.samples.size());
+  CHECK(strictlyIncreasing(log.samples), "sample times go backwards");
+  CHECK(eventField(log, 'T', 1) == (long long)log.samples.size(), "footer counts %lld samples, file has %zu",
+        eventField(log, 'T', 1), log.samples.size());
+
+  std::string summary = decodeBytes(bytes, summarize, rc);
+  CHECK(rc == 0 && summary.find("#S,") != std::string::npos && summary.find("#T,") != std::string::npos,
+        "summary without header or footer:\n%s", summary.c_str());
+  uint32_t first = (uint32_t)(log.samples.front() / 1000);
+  checkRange(bytes, log, first + 10, first + 40);
+  printf("  %zu samples, %zu-byte binary log, %zu bytes of CSV\n", log.samples.size(), bytes.size(), csv.size());
+}
+#endif
+
+#if LOG_SEEK_INDEX
+// A delta or compressed log from the device decodes to device CSV lines
+// whose footer counts them. A -t window starting inside a block reads the
+// same through the seek index as from a full decode, and the log with its
+// index cut off still decodes, ranges and summarizes, all in full.
+void testSeekIndexDecode() {
+  std::vector<uint8_t> bytes = logDrive(120000);
+  int rc;
+  std::string csv = decodeBytes(bytes, decoder::decodeFile, rc);
+  CHECK(rc == 0, "the decoder returned %d", rc);
+  size_t start = decoder::csvHeaderEnd((const uint8_t*)csv.data(), csv.size()), misshapen = 0;
+  CHECK(start > 0 && (csv.size() - start) % LOG_LINE_SIZE == 0, "%zu bytes after a %zu-byte column line",
+        csv.size() - start, start);
+  for (size_t at = start; at + LOG_LINE_SIZE <= csv.size(); at += LOG_LINE_SIZE)
+    if (csv[at] == ' ' || std::count(csv.begin() + at, csv.begin() + at + LOG_LINE_SIZE, '\n') != 1) misshapen++;
+  CHECK(misshapen == 0, "%zu lines are not one padded LOG_LINE_SIZE line", misshapen);
+  CsvLog log = readCsvLog(std::vector<uint8_t>(csv.begin(), csv.end()));
+  CHECK(log.samples.size() > 100 * LOG_RATE_HZ, "%zu samples", log.samples.size());
+  CHECK(strictlyIncreasing(log.samples), "sample times go backwards");
+  CHECK(eventField(log, 'T', 1) == (long long)log.samples.size(), "footer counts %lld samples, file has %zu",
+        eventField(log, 'T', 1), log.samples.size());
+
+  std::vector<LogIndexEntry> index;
+  long dataEnd = 0;
+  decodeBytes(bytes, [&](FILE *in, FILE *) { return decoder::readSeekIndex(in, index, dataEnd) ? 0 : 1; }, rc);
+  CHECK(rc == 0 && index.size() >= 4 && dataEnd < (long)bytes.size(), "%zu index entries, data ends at %ld of %zu",
+        index.size(), dataEnd, bytes.size());
+  // A window from a second inside a block halfway in: the range decode
+  // starts at that block and drops what comes before the window
+  size_t k = index.size() / 2;
+  while (k + 1 < index.size() && index[k + 1].time < index[k].time + 2) k++;
+  CHECK(k + 1 < index.size(), "no block spans 2 s");
+  uint32_t from = index[k].time + 1, to = from + 30;
+  if (k + 1 < index.size()) checkRange(bytes, log, from, to);
+
+  // Without the index: readSeekIndex() says so and every path decodes in full
+  std::vector<uint8_t> bare(bytes.begin(), bytes.begin() + std::min(dataEnd, (long)bytes.size()));
+  std::vector<LogIndexEntry> none;
+  long bareEnd = 0;
+  decodeBytes(bare, [&](FILE *in, FILE *) { return decoder::readSeekIndex(in, none, bareEnd) ? 0 : 1; }, rc);
+  CHECK(rc == 1 && none.empty() && bareEnd == (long)bare.size(), "the cut log still has %zu index entries",
+        none.size());
+  std::string bareCsv = decodeBytes(bare, decoder::decodeFile, rc);
+  CHECK(rc == 0 && bareCsv == csv, "without the index: %zu bytes decoded of %zu", bareCsv.size(), csv.size());
+  if (k + 1 < index.size()) checkRange(bare, log, from, to);
+  int bareRc;
+  std::string summary = decodeBytes(bytes, summarize, rc), bareSummary = decodeBytes(bare, summarize, bareRc);
+  CHECK(rc == 0 && bareRc == 0 && summary.find("#T,") != std::string::npos, "summary without a footer:\n%s",
+        summary.c_str());
+  CHECK(bareSummary == summary, "summary without the index:\n%s", bareSummary.c_str());
+  printf("  %zu samples, %zu-byte log, %zu index entries, window from inside block %zu\n", log.samples.size(),
+         bytes.size(), index.size(), k);
+}
+#endif
+
+// ==================== PULSE STREAM ====================
+#if PULSE_LOG
+// Hall edges at 20 kHz from a thread standing in for the interrupt, for 10 s
+// of logging: every edge reaches /R*.BIN, the decoder reads each one back,
+// and no PULSE_REC_DROPS record says otherwise.
+void testPulseStream20k() {
+  auto card = newCard();
+  boot(card);
+  runFor(3000);
+  click();
+  CHECK(isLogging, "logging did not start");
+  std::string path = pulseLogName(String(trackFileName)).c_str();
+  std::atomic<bool> stop{false};
+  uint32_t fired = 0;
+  std::thread isr([&] {
+    for (uint64_t next = sim::nowMicros(); !stop;) {
+      for (uint64_t now = sim::nowMicros(); next <= now; next += 50) { hallISR(); fired++; }
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  });
+  runFor(10000);
+  stop = true;
+  isr.join();
+  step(); // drains the ring
+  lastToggleMillis = 0;
+  click();
+  CHECK(!isLogging && waitWriterIdle(), "logging did not stop");
+  CHECK(pulseDropped == 0, "%lu pulses dropped", (unsigned long)pulseDropped);
+
+  std::vector<uint8_t> bytes = sim::fileBytes(card, path);
+  CHECK(bytes.size() > sizeof(PulseFileHeader), "%s holds %zu bytes", path.c_str(), bytes.size());
+  if (bytes.size() <= sizeof(PulseFileHeader)) return;
+  PulseFileHeader hdr;
+  memcpy(&hdr, bytes.data(), sizeof(hdr));
+  std::vector<uint8_t> body(bytes.begin() + sizeof(hdr), bytes.end());
+  size_t walked = 0, dropRecords = 0;
+  bool parsed = decoder::walkPulseBody(body, hdr.baseMicros, [&](uint64_t) { walked++; },
+                                       [](uint64_t, const PulseSync &) {}, [&](uint32_t) { dropRecords++; });
+  CHECK(parsed, "the pulse body does not parse");
+  CHECK(dropRecords == 0, "%zu PULSE_REC_DROPS records", dropRecords);
+  int rc;
+  std::string csv = decodeBytes(bytes, decoder::decodeFile, rc);
+  size_t lines = std::count(csv.begin(), csv.end(), '\n');
+  CHECK(rc == 0, "the decoder returned %d", rc);
+  CHECK(lines == fired + 1, "the decoder wrote %zu pulse lines for %lu edges", lines - 1, (unsigned long)fired);
+  CHECK(walked == fired, "the file holds %zu pulses for %lu edges", walked, (unsigned long)fired);
+  printf("  %lu edges, %zu-byte pulse log (%.2f bytes/edge)\n", (unsigned long)fired, bytes.size(),
+         (double)body.size() / (fired ? fired : 1));
+}
+#endif
+
+// ==================== CARD SWAP ====================
+#if CSV_TRACK
+// The card is pulled while logging and another one, slow to mount, goes in.
+// The writer mounts and scans it, so loop() never stalls; the continuation
+// file picks up where the old card's intact blocks end, and its footer counts
+// exactly the samples it holds.
+void testCardSwap() {
+  auto card = newCard();
+  boot(card);
+  runFor(3000);
+  click();
+  CHECK(isLogging, "logging did not start");
+  runFor(15000);
+  std::string old = trackFileName;
+  auto next = newCard(2);
+  next->mountMs = 1500;                 // ~10 s to negotiate a clock
+  unsigned long worst = 0;
+  auto timedRun = [&](unsigned long ms) {
+    unsigned long end = millis() + ms;
+    while (millis() < end) {
+      unsigned long t0 = millis();
+      step();
+      worst = std::max(worst, millis() - t0);
+    }
+  };
+  sim::eject();
+  CHECK(runUntil([] { return !sdInserted; }, 5000), "removal not seen");
+  // From here to the resume the card is the writer's: loop() must neither
+  // mount nor wait for the mutex, however long the writer spends on either
+  uint32_t begins = sim::threadBeginCalls, waits = sim::blockedTakes;
+  timedRun(8000);
+  CHECK(sdSwapState == SD_SWAP_OUT, "swap state %u with the slot empty", (unsigned)sdSwapState);
+  sim::insert(next);
+  timedRun(30000);
+  CHECK(sdSwapState == SD_SWAP_NONE && isLogging, "the session did not continue on the next card");
+  begins = sim::threadBeginCalls - begins;
+  waits = sim::blockedTakes - waits;
+  CHECK(begins == 0, "loop() called SD.begin() %lu times during the swap", (unsigned long)begins);
+  CHECK(waits == 0, "loop() waited for sdMutex %lu times during the swap", (unsigned long)waits);
+  lastToggleMillis = 0;
+  click();
+  CHECK(!isLogging && waitWriterIdle(), "logging did not stop");
+
+  std::vector<uint8_t> oldBytes = sim::fileBytes(card, old);
+  LogJournalScan oldScan;
+  logJournalFeed(oldScan, oldBytes.data(), oldBytes.size());
+  oldBytes.resize(oldScan.end);
+  CsvLog before = readCsvLog(oldBytes), after = readCsvLog(next, newestLog(next));
+  LogJournalScan j;
+  CHECK(journalIntact(after, j), "journal ends at %zu of %zu bytes", j.end, after.bytes.size());
+  CHECK(!before.samples.empty() && !after.samples.empty(), "%zu samples before the swap, %zu after",
+        before.samples.size(), after.samples.size());
+  CHECK(eventField(after, 'W', 2) == 0, "#W reports %lld samples lost", eventField(after, 'W', 2));
+  CHECK(eventField(after, 'T', 1) == (long long)after.samples.size(), "footer counts %lld samples, file has %zu",
+        eventField(after, 'T', 1), after.samples.size());
+  CHECK(strictlyIncreasing(after.samples), "sample times go backwards");
+  CHECK(!before.samples.empty() && !after.samples.empty() &&
+        after.samples.front() <= before.samples.back() + (int64_t)LOG_SAMPLE_PERIOD_MS * 3 / 2,
+        "samples from %lld to %lld ms missing", (long long)before.samples.back(), (long long)after.samples.front());
+  CHECK(trackDropped == 0, "%lu samples dropped", (unsigned long)trackDropped);
+  printf("  %zu samples on the old card, %zu on the next, loop() at most %lu ms\n", before.samples.size(),
+         after.samples.size(), worst);
+}
+#endif
+
+// ==================== SD CLOCK ====================
+// A new card is first mounted at SD_SPI_SAFE_HZ. Once a card is known, an
+// empty slot still costs one SD.begin() per check at that clock, and the
+// known card back in the slot mounts there, then once at its own clock.
+void testMountProbes() {
+  auto card = newCard();
+  boot(card);
+  CHECK(sdInserted, "card not mounted");
+  CHECK(!sim::beginHz.empty() && sim::beginHz[0] == SD_SPI_SAFE_HZ, "new card first mounted at %lu Hz",
+        sim::beginHz.empty() ? 0UL : (unsigned long)sim::beginHz[0]);
+  CHECK(sim::mountHz == card->maxHz, "new card mounted at %lu Hz", (unsigned long)sim::mountHz);
+
+  sim::eject();
+  CHECK(runUntil([] { return !sdInserted; }, 5000), "removal not seen");
+  sim::beginHz.clear();
+  uint32_t checksBefore = sdProbeCount;
+  runFor(10000);
+  uint32_t checks = sdProbeCount - checksBefore;
+  CHECK(checks >= 4 && sim::beginHz.size() == checks, "%zu SD.begin() calls for %lu checks of the empty slot",
+        sim::beginHz.size(), (unsigned long)checks);
+  for (uint32_t hz : sim::beginHz) CHECK(hz == SD_SPI_SAFE_HZ, "empty slot probed at %lu Hz", (unsigned long)hz);
+
+  sim::beginHz.clear();
+  sim::insert(card);
+  CHECK(runUntil([] { return sdInserted; }, 5000), "card not mounted again");
+  CHECK(sim::beginHz == std::vector<uint32_t>({SD_SPI_SAFE_HZ, card->maxHz}), "%zu SD.begin() calls to remount",
+        sim::beginHz.size());
+  CHECK(sim::mountHz == card->maxHz, "known card remounted at %lu Hz", (unsigned long)sim::mountHz);
+  printf("  %lu checks of the empty slot, %zu SD.begin() calls to remount a known card\n", (unsigned long)checks,
+         sim::beginHz.size());
+}
+
+// ==================== HEALTH RECORDS ====================
+#if CSV_TRACK
+// Health records fall due while the writer sits in a 20 s write and every
+// buffer is full: loop() must not wait for the writer, and the #H lines
+// reach the track once there is room again.
+void testHealthOnSlowCard() {
+  auto card = newCard();
+  boot(card);
+  runFor(3000);
+  click();
+  CHECK(isLogging, "logging did not start");
+  std::string track = trackFileName;
+  // A block written first, so the window holds writes as well as handoffs
+  CHECK(runUntil([] { return sdLatencyWindow[LOG_LAT_WRITE].total > 0 && logWriterIdle(); }, 30000),
+        "nothing was written");
+  card->writeMs = [](size_t) { return 20000.0; };
+  CHECK(runUntil([] { return trackOverflowCount > 20; }, 120000), "the track never overflowed");
+  lastHealthMillis = millis() - LOG_HEALTH_SECONDS * 1000UL;
+  unsigned long t0 = millis();
+  uint32_t waits = sim::blockedTakes;
+  step();
+  unsigned long took = millis() - t0;
+  waits = sim::blockedTakes - waits;
+  CHECK(lastHealthMillis >= t0, "health record not taken");
+  CHECK(waits == 0, "loop() waited %lu times for the writer's mutex", (unsigned long)waits);
+  card->writeMs = nullptr;
+  runFor(30000);
+  lastToggleMillis = 0;
+  click();
+  CHECK(!isLogging, "logging did not stop");
+
+  CsvLog log = readCsvLog(card, track);
+  size_t health = 0;
+  for (const std::string &e : log.events) if (e.compare(0, 3, "#H,") == 0) health++;
+  CHECK(health >= 2, "%zu #H lines in the track", health);
+  printf("  loop() took %lu ms with the health record due, %zu #H lines\n", took, health);
+}
+#endif
+
+// ==================== POWER CUTS ====================
+#if CSV_TRACK
+// A power cut before any sector of the track reaches the card, or halfway
+// through one, must leave a log that boot recovery cuts back to exactly the
+// journal blocks that were durable: no fewer, and never the older log that
+// pre-allocation left in the file's clusters.
+struct PowerCut {
+  size_t offset;                 // sector about to be written
+  std::vector<uint8_t> disk;     // the file's durable bytes up to past the data
+  size_t dirSize;
+};
+
+// An older CSV log with its own salt: lines and #J blocks that parse
+std::vector<uint8_t> olderLog(size_t bytes) {
+  const char hdr[] = "lat,lon,speed_mph,UTC_datetime,RPM\r\n";
+  std::vector<uint8_t> out(hdr, hdr + sizeof(hdr) - 1);
+  uint32_t seq = 0, salt = 0x5eed01d5, crc = 0, blockBytes = 0;
+  for (int i = 0; out.size() < bytes; ++i) {
+    char line[80];
+    LogLineFields f;
+    logLineFieldsFromRecord(f, sampleAt((feed.startSecond - 86400) * 1000 + i * 100), true);
+    formatPaddedLogLine(line, f);
+    out.insert(out.end(), line, line + LOG_LINE_SIZE);
+    crc = crc32Update(crc, line, LOG_LINE_SIZE);
+    blockBytes += LOG_LINE_SIZE;
+    if (i % 50 == 49) {
+      formatJournalLine(line, ++seq, blockBytes, salt, crc);
+      out.insert(out.end(), line, line + LOG_JOURNAL_LINE_SIZE);
+      crc = blockBytes = 0;
+    }
+  }
+  return out;
+}
+
+std::vector<uint8_t> recoverImage(const std::string &path, const PowerCut &cut, const sim::Card &from) {
+  auto img = std::make_shared<sim::Card>(from);
+  img->beforeSector = nullptr;
+  img->writeMs = nullptr;
+  img->files.clear();
+  auto d = std::make_shared<sim::FileData>();
+  d->disk = cut.disk;
+  d->disk.resize(cut.dirSize);
+  for (size_t i = cut.disk.size(); i < cut.dirSize; ++i) d->disk[i] = img->staleAt(i);
+  d->live = d->disk;
+  d->dirSize = cut.dirSize;
+  img->files[path] = d;
+  sim::insert(img);
+  if (!SD.begin()) return {};
+  scanLogFiles();
+  return sim::fileBytes(img, path);
+}
+
+void testPowerCuts() {
+  auto card = newCard();
+  card->stale = olderLog(256 * 1024);
+  std::string track;
+  std::vector<PowerCut> cuts;
+  boot(card);
+  runFor(3000);
+  // Every sector of the track file, as the writer task is about to put it on the card
+  card->beforeSector = [&](const std::string &path, size_t off, const uint8_t *data, size_t len) {
+    if (track.empty() || path != track) return;
+    const sim::FileData &f = *card->files[path];
+    size_t keep = std::min(f.disk.size(), off + len + 4 * LOG_SECTOR_SIZE);
+    PowerCut whole = {off, std::vector<uint8_t>(f.disk.begin(), f.disk.begin() + keep), f.dirSize};
+    PowerCut torn = whole;
+    memcpy(torn.disk.data() + off, data, len / 2);
+    cuts.push_back(std::move(whole));
+    cuts.push_back(std::move(torn));
+  };
+  click();
+  CHECK(isLogging, "logging did not start");
+  {
+    std::lock_guard<std::recursive_mutex> l(sim::fsMutex);
+    track = trackFileName;
+  }
+  uint64_t sectorsBefore = card->sectorWrites;
+  runFor(90000);
+  lastToggleMillis = 0;
+  click();
+  CHECK(!isLogging, "logging did not stop");
+  card->beforeSector = nullptr;
+  uint64_t sectors = card->sectorWrites - sectorsBefore;
+
+  CsvLog log = readCsvLog(card, track);
+  LogJournalScan final;
+  CHECK(journalIntact(log, final), "final log: journal ends at %zu of %zu", final.end, log.bytes.size());
+  std::vector<size_t> blockEnds;
+  {
+    LogJournalScan j;
+    for (size_t i = 0; i < log.bytes.size(); ++i) {
+      logJournalFeed(j, log.bytes.data() + i, 1);
+      if (blockEnds.empty() || j.end != blockEnds.back()) blockEnds.push_back(j.end);
+    }
+  }
+  size_t unaligned = 0;
+  for (size_t e : blockEnds) if (e % LOG_SECTOR_SIZE != 0) unaligned++;
+
+  size_t checked = 0, bad = 0;
+  for (const PowerCut &cut : cuts) {
+    std::vector<uint8_t> got = recoverImage(track, cut, *card);
+    // Bytes this cut left as they are in the final log
+    size_t same = 0;
+    while (same < cut.disk.size() && same < cut.dirSize && same < log.bytes.size() && cut.disk[same] == log.bytes[same]) same++;
+    size_t want = 0;
+    for (size_t e : blockEnds) if (e <= same) want = e;
+    LogJournalScan j;
+    logJournalFeed(j, got.data(), got.size());
+    bool prefix = got.size() <= log.bytes.size() && std::equal(got.begin(), got.end(), log.bytes.begin());
+    // A header-only log is a session that never logged, and boot removes it
+    bool ok = prefix && (got.empty() ? want <= blockEnds[1] : got.size() == want && j.end == got.size());
+    if (!ok && bad++ < 5)
+      fprintf(stderr, "  cut before sector at %zu (%s): recovered %zu bytes, want %zu, journal to %zu%s\n", cut.offset,
+              (&cut - cuts.data()) % 2 ? "torn" : "whole", got.size(), want, j.end, prefix ? "" : ", not a prefix");
+    checked++;
+  }
+  CHECK(bad == 0, "%zu of %zu power cuts recovered wrong", bad, checked);
+  printf("  %zu power cuts; %zu-byte log, %zu of %zu blocks end off a sector boundary; %llu sectors written "
+         "for %zu (x%.2f)\n", checked, log.bytes.size(), unaligned, blockEnds.size(), (unsigned long long)sectors,
+         (log.bytes.size() + LOG_SECTOR_SIZE - 1) / LOG_SECTOR_SIZE,
+         sectors / (double)((log.bytes.size() + LOG_SECTOR_SIZE - 1) / LOG_SECTOR_SIZE));
+}
+#endif
+
+// ==================== RETAINED RING ====================
+#if CSV_TRACK && RETAINED_RECORDS
+// A reset while the writer is still stuck on the old log's last blocks after a
+// rollover: the ring must still name the old log, and restoring it puts back
+// every sample that log was meant to hold.
+void testRolloverReset() {
+  auto card = newCard();
+  boot(card);
+  runFor(3000);
+  click();
+  CHECK(isLogging, "logging did not start");
+  runFor(12000);
+  // Stall the card while the writer is idle and samples wait in the fill
+  // buffer, so the rollover is taken at once and the old log's last block,
+  // with those samples, is the one that gets stuck
+  CHECK(runUntil([] { return logWriterIdle() && gpsLog.fillBytes >= 2 * LOG_RECORD_SIZE &&
+                             gpsLog.fillBytes + TRACK_FOOTER_BYTES <= gpsLog.bufferSize; }, 20000),
+        "the writer never went idle with samples in the fill buffer");
+  card->writeMs = [](size_t) { return 15000.0; };
+  std::string old = trackFileName;
+  CHECK(runUntil([] { return rolloverLogFile(millis()); }, 1000), "rollover was not taken");
+  runFor(2000);
+  CHECK(logRolloverPending, "the writer switched files on a stalled card");
+  std::shared_ptr<sim::Card> img;
+  {
+    std::lock_guard<std::recursive_mutex> l(sim::fsMutex);
+    img = card->durableImage();
+  }
+  RetainedLog saved = retained;
+
+  card->writeMs = nullptr;
+  lastToggleMillis = 0;
+  click();
+  CHECK(!isLogging && waitWriterIdle(), "logging did not stop");
+  CHECK(!logRolloverPending, "rollover still pending after close");
+  CsvLog final = readCsvLog(card, old);
+  std::vector<uint8_t> atReset = sim::fileBytes(img, old);
+  LogJournalScan intact;
+  logJournalFeed(intact, atReset.data(), atReset.size());
+  atReset.resize(intact.end);
+  size_t durable = readCsvLog(atReset).samples.size();
+
+  // The reset: boot with the image and the ring as the stall left them
+  sim::insert(img);
+  CHECK(SD.begin(), "image did not mount");
+  sim::resetReason = ESP_RST_PANIC;
+  retained = saved;
+  restoreRetainedLog();
+  CsvLog restored = readCsvLog(img, old);
+  LogJournalScan j;
+  CHECK(journalIntact(restored, j), "journal ends at %zu of %zu bytes", j.end, restored.bytes.size());
+  CHECK(restored.samples == final.samples, "restored %zu samples (%zu were durable), the log had %zu",
+        restored.samples.size(), durable, final.samples.size());
+  CHECK(durable < final.samples.size(), "every block was intact at the reset");
+  printf("  %zu of %zu samples in intact blocks at the reset, %zu after restoring\n", durable, final.samples.size(),
+         restored.samples.size());
+}
+#endif
+
+// ==================== MAIN ====================
+struct Test { const char *name; void (*run)(); };
+const Test tests[] = {
+#if CSV_TRACK
+  {"slow-sd-close", testSlowSdClose},
+  {"write-failure-closes", testWriteFailureCloses},
+  {"failed-short-block", testFailedShortBlock},
+  {"jittered-fixes", testJitteredFixes},
+#endif
+  {"rpm-from-pulses", testRpmFromPulses},
+  {"binary-scan-stale-tail", testBinaryScanStopsAtStaleTail},
+  {"delta-round-trip", testDeltaRoundTrip},
+  {"delta-recovery", testDeltaRecovery},
+#if LOG_FORMAT == LOG_FORMAT_BINARY && !LOG_COMPRESS
+  {"binary-decode", testBinaryDecode},
+#endif
+#if LOG_SEEK_INDEX
+  {"seek-index-decode", testSeekIndexDecode},
+#endif
+#if PULSE_LOG
+  {"pulse-stream-20k", testPulseStream20k},
+#endif
+#if CSV_TRACK
+  {"card-swap", testCardSwap},
+#endif
+  {"mount-probes", testMountProbes},
+#if CSV_TRACK
+  {"health-slow-card", testHealthOnSlowCard},
+  {"power-cuts", testPowerCuts},
+#endif
+#if CSV_TRACK && RETAINED_RECORDS
+  {"rollover-reset", testRolloverReset},
+#endif
+};
+
+int main(int argc, char **argv) {
+  int failed = 0, ran = 0;
+  for (const Test &t : tests) {
+    if (argc > 1 && !strstr(t.name, argv[1])) continue;
+    ran++;
+    printf("%s\n", t.name);
+    fflush(stdout);
+    auto t0 = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid == 0) {
+      alarm(300);
+      sim::start = std::chrono::steady_clock::now();
+      t.run();
+      if (testFailed) {
+        std::lock_guard<std::mutex> lock(sim::serialMutex);
+        size_t from = sim::serialOut.size() > 3000 ? sim::serialOut.size() - 3000 : 0;
+        fprintf(stderr, "  --- Serial (last 3000 bytes) ---\n%s\n", sim::serialOut.c_str() + from);
+      }
+      fflush(stdout);
+      _exit(testFailed ? 1 : 0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    printf("  %s (%.1f s)\n", ok ? "ok" : WIFSIGNALED(status) ? "CRASHED" : "FAILED", s);
+    if (!ok) failed++;
+  }
+  printf("%d of %d tests passed\n", ran - failed, ran);
+  return failed ? 1 : 0;
+}
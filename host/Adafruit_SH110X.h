@@ -0,0 +1,24 @@
+#ifndef MINI_LOGGER_HOST_SH110X_H
+#define MINI_LOGGER_HOST_SH110X_H
+
+#include "Wire.h"
+
+#define SH110X_WHITE 1
+
+// The OLED: accepts everything, shows nothing
+class Adafruit_SH1107 : public Print {
+ public:
+  Adafruit_SH1107(int, int, TwoWire*) {}
+  bool begin(int, bool) { return true; }
+  void setRotation(int) {}
+  void clearDisplay() {}
+  void setTextSize(int) {}
+  void setTextColor(int) {}
+  void setCursor(int, int) {}
+  void display() {}
+  void drawBitmap(int, int, const unsigned char*, int, int, int) {}
+  using Print::write;
+  size_t write(uint8_t) override { return 1; }
+};
+
+#endif
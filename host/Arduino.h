@@ -0,0 +1,319 @@
+/*
+  Mini Logger - Host Arduino Core (Log-test.cpp only)
+  - Just enough of the ESP32 Arduino core and FreeRTOS to build the sketch on
+    a PC: String, Print, Serial, pins, millis()/micros(), queues, semaphores,
+    tasks (std::thread) and critical sections
+  - Time is simulated: it runs sim::scale times faster than the wall clock, so
+    both the loop() thread and the writer task see the same millis() and a
+    minute of logging takes a few seconds
+*/
+
+#ifndef MINI_LOGGER_HOST_ARDUINO_H
+#define MINI_LOGGER_HOST_ARDUINO_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <math.h>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define IRAM_ATTR
+#define RTC_NOINIT_ATTR
+#define RTC_DATA_ATTR
+#define PROGMEM
+#define HIGH 1
+#define LOW 0
+#define INPUT 0x01
+#define INPUT_PULLUP 0x05
+#define FALLING 0x02
+#define CHANGE 0x03
+typedef uint8_t byte;
+
+// ==================== SIMULATED TIME ====================
+namespace sim {
+inline double scale = 20;   // simulated ms per wall-clock ms
+inline std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+inline uint64_t bootMicros = 100000000ULL; // clock at start: 100 s after boot
+
+inline uint64_t nowMicros() {
+  auto real = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+  return bootMicros + (uint64_t)(real * scale / 1000);
+}
+
+inline std::chrono::nanoseconds realTime(double ms) { return std::chrono::nanoseconds((int64_t)(ms * 1e6 / scale)); }
+
+inline void sleepMs(double ms) {
+  if (ms <= 0) std::this_thread::yield();
+  else std::this_thread::sleep_for(realTime(ms));
+}
+
+inline int pins[64];                      // digitalRead() levels, set by the test
+inline uint32_t supplyMv = 4000;          // analogReadMilliVolts() * VBAT_DIVIDER
+inline std::mt19937 rng(1);
+} // namespace sim
+
+inline unsigned long millis() { return (unsigned long)(sim::nowMicros() / 1000); }
+inline unsigned long micros() { return (unsigned long)(uint32_t)sim::nowMicros(); }
+inline void delay(unsigned long ms) { sim::sleepMs(ms); }
+inline void delayMicroseconds(unsigned us) { sim::sleepMs(us / 1000.0); }
+inline void yield() { std::this_thread::yield(); }
+inline int64_t esp_timer_get_time() { return (int64_t)sim::nowMicros(); }
+
+inline int digitalRead(int pin) { return sim::pins[pin & 63]; }
+inline void pinMode(int pin, int mode) { if (mode == INPUT_PULLUP) sim::pins[pin & 63] = HIGH; }
+inline int analogRead(int) { return 0; }
+inline uint32_t analogReadMilliVolts(uint8_t) { return sim::supplyMv / 2; }
+inline int digitalPinToInterrupt(int pin) { return pin; }
+inline void attachInterrupt(int, void (*)(), int) {}
+inline void detachInterrupt(int) {}
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+inline void randomSeed(unsigned long seed) { sim::rng.seed((uint32_t)seed); }
+inline long random(long hi) { return hi > 0 ? (long)(sim::rng() % (unsigned long)hi) : 0; }
+inline long random(long lo, long hi) { return lo + random(hi - lo); }
+inline uint32_t esp_random() { return sim::rng(); }
+
+// ==================== STRING ====================
+class String {
+ public:
+  String(const char *s = "") : s_(s ? s : "") {}
+  String(const std::string &s) : s_(s) {}
+  String(char c) : s_(1, c) {}
+  String(int v) : s_(std::to_string(v)) {}
+  String(unsigned v) : s_(std::to_string(v)) {}
+  String(long v) : s_(std::to_string(v)) {}
+  String(unsigned long v) : s_(std::to_string(v)) {}
+  String(double v, int decimals = 2) { char b[64]; snprintf(b, sizeof(b), "%.*f", decimals, v); s_ = b; }
+
+  size_t length() const { return s_.size(); }
+  const char *c_str() const { return s_.c_str(); }
+  char operator[](size_t i) const { return i < s_.size() ? s_[i] : 0; }
+  void setCharAt(size_t i, char c) { if (i < s_.size()) s_[i] = c; }
+  String substring(size_t from, size_t to = std::string::npos) const {
+    if (from > s_.size()) return String();
+    return String(s_.substr(from, to == std::string::npos || to < from ? std::string::npos : to - from));
+  }
+  bool startsWith(const String &p) const { return s_.compare(0, p.s_.size(), p.s_) == 0; }
+  bool endsWith(const String &p) const {
+    return s_.size() >= p.s_.size() && s_.compare(s_.size() - p.s_.size(), p.s_.size(), p.s_) == 0;
+  }
+  long toInt() const { return atol(s_.c_str()); }
+
+  String operator+(const String &o) const { return String(s_ + o.s_); }
+  String &operator+=(const String &o) { s_ += o.s_; return *this; }
+  friend String operator+(const char *a, const String &b) { return String(std::string(a) + b.s_); }
+  bool operator==(const String &o) const { return s_ == o.s_; }
+  bool operator!=(const String &o) const { return s_ != o.s_; }
+  bool operator<(const String &o) const { return s_ < o.s_; }
+  bool operator>(const String &o) const { return s_ > o.s_; }
+
+ private:
+  std::string s_;
+};
+
+// ==================== PRINT / SERIAL ====================
+class Print {
+ public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buf, size_t n) {
+    size_t done = 0;
+    while (done < n && write(buf[done])) done++;
+    return done;
+  }
+  size_t print(const char *s) { return write((const uint8_t*)s, strlen(s)); }
+  size_t print(const String &s) { return print(s.c_str()); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(int v) { return printf("%d", v); }
+  size_t print(unsigned v) { return printf("%u", v); }
+  size_t print(long v) { return printf("%ld", v); }
+  size_t print(unsigned long v) { return printf("%lu", v); }
+  size_t print(double v, int decimals = 2) { return printf("%.*f", decimals, v); }
+  template <class T> size_t println(const T &v) { size_t n = print(v); return n + print("\r\n"); }
+  size_t println() { return print("\r\n"); }
+  size_t printf(const char *fmt, ...) __attribute__((format(printf, 2, 3))) {
+    char buf[512];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (n < 0) return 0;
+    return write((const uint8_t*)buf, (size_t)n < sizeof(buf) ? (size_t)n : sizeof(buf) - 1);
+  }
+};
+
+class Stream : public Print {
+ public:
+  virtual int available() { return 0; }
+  virtual int read() { return -1; }
+  virtual int peek() { return -1; }
+};
+
+namespace sim {
+inline std::mutex serialMutex;
+inline std::string serialOut;             // everything the sketch printed
+inline bool serialEcho = getenv("LOG_TEST_VERBOSE") != nullptr;
+} // namespace sim
+
+// USB serial: output is collected in sim::serialOut, input comes from input
+class HWCDC : public Stream {
+ public:
+  std::string input;                      // commands typed by the test, read by loop()
+  void begin(unsigned long) {}
+  operator bool() const { return true; }
+  using Print::write;
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t *buf, size_t n) override {
+    std::lock_guard<std::mutex> lock(sim::serialMutex);
+    sim::serialOut.append((const char*)buf, n);
+    if (sim::serialEcho) fwrite(buf, 1, n, stderr);
+    return n;
+  }
+  int available() override { return (int)input.size(); }
+  int read() override {
+    if (input.empty()) return -1;
+    int c = (uint8_t)input[0];
+    input.erase(0, 1);
+    return c;
+  }
+};
+inline HWCDC Serial;
+
+// ==================== ESP ====================
+typedef enum {
+  ESP_RST_UNKNOWN, ESP_RST_POWERON, ESP_RST_EXT, ESP_RST_SW, ESP_RST_PANIC, ESP_RST_INT_WDT,
+  ESP_RST_TASK_WDT, ESP_RST_WDT, ESP_RST_DEEPSLEEP, ESP_RST_BROWNOUT, ESP_RST_SDIO
+} esp_reset_reason_t;
+namespace sim { inline esp_reset_reason_t resetReason = ESP_RST_POWERON; }
+inline esp_reset_reason_t esp_reset_reason() { return sim::resetReason; }
+
+struct EspClass {
+  uint32_t getCycleCount() { return (uint32_t)(sim::nowMicros() * 160); }
+  uint32_t getCpuFreqMHz() { return 160; }
+  uint32_t getFreeHeap() { return 200000; }
+  void restart() { exit(3); }
+};
+inline EspClass ESP;
+
+// ==================== FREERTOS ====================
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint32_t TickType_t;
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define portMAX_DELAY 0xffffffffu
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define tskIDLE_PRIORITY 0
+
+namespace sim {
+template <class Pred>
+bool waitFor(std::unique_lock<std::mutex> &lock, std::condition_variable &cv, TickType_t ticks, Pred ready) {
+  if (ticks == portMAX_DELAY) { cv.wait(lock, ready); return true; }
+  return cv.wait_for(lock, realTime(ticks), ready);
+}
+
+struct Queue {
+  std::mutex m;
+  std::condition_variable cv;
+  std::deque<std::vector<uint8_t>> items;
+  size_t capacity, itemSize;
+};
+
+struct Semaphore {
+  std::mutex m;
+  std::condition_variable cv;
+  int count, max;
+};
+
+inline thread_local uint32_t blockedTakes = 0; // xSemaphoreTake() calls by this thread that had to wait
+} // namespace sim
+
+typedef sim::Queue *QueueHandle_t;
+typedef sim::Semaphore *SemaphoreHandle_t;
+typedef void *TaskHandle_t;
+
+inline QueueHandle_t xQueueCreate(unsigned length, unsigned itemSize) {
+  sim::Queue *q = new sim::Queue;
+  q->capacity = length;
+  q->itemSize = itemSize;
+  return q;
+}
+
+inline BaseType_t queuePut(QueueHandle_t q, const void *item, TickType_t ticks, bool front) {
+  std::unique_lock<std::mutex> lock(q->m);
+  if (!sim::waitFor(lock, q->cv, ticks, [&] { return q->items.size() < q->capacity; })) return pdFALSE;
+  std::vector<uint8_t> v((const uint8_t*)item, (const uint8_t*)item + q->itemSize);
+  if (front) q->items.push_front(v);
+  else q->items.push_back(v);
+  q->cv.notify_all();
+  return pdTRUE;
+}
+
+inline BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t ticks) { return queuePut(q, item, ticks, false); }
+inline BaseType_t xQueueSendToFront(QueueHandle_t q, const void *item, TickType_t ticks) { return queuePut(q, item, ticks, true); }
+
+inline BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t ticks) {
+  std::unique_lock<std::mutex> lock(q->m);
+  if (!sim::waitFor(lock, q->cv, ticks, [&] { return !q->items.empty(); })) return pdFALSE;
+  memcpy(item, q->items.front().data(), q->itemSize);
+  q->items.pop_front();
+  q->cv.notify_all();
+  return pdTRUE;
+}
+
+inline UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q) {
+  std::lock_guard<std::mutex> lock(q->m);
+  return (UBaseType_t)q->items.size();
+}
+
+inline SemaphoreHandle_t xSemaphoreCreateMutex() { return new sim::Semaphore{{}, {}, 1, 1}; }
+inline SemaphoreHandle_t xSemaphoreCreateBinary() { return new sim::Semaphore{{}, {}, 0, 1}; }
+
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t s, TickType_t ticks) {
+  std::unique_lock<std::mutex> lock(s->m);
+  if (s->count == 0 && ticks != 0) sim::blockedTakes++;
+  if (!sim::waitFor(lock, s->cv, ticks, [&] { return s->count > 0; })) return pdFALSE;
+  s->count--;
+  return pdTRUE;
+}
+
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t s) {
+  std::lock_guard<std::mutex> lock(s->m);
+  if (s->count == s->max) return pdFALSE;
+  s->count++;
+  s->cv.notify_all();
+  return pdTRUE;
+}
+
+inline BaseType_t xTaskCreate(void (*fn)(void*), const char *, uint32_t, void *arg, UBaseType_t, TaskHandle_t *handle) {
+  std::thread(fn, arg).detach();
+  if (handle) *handle = nullptr;
+  return pdPASS;
+}
+
+inline void vTaskDelay(TickType_t ticks) { sim::sleepMs(ticks); }
+inline TickType_t xTaskGetTickCount() { return (TickType_t)millis(); }
+
+// Critical sections: a spinlock, as on the single-core C3
+struct portMUX_TYPE { std::atomic_flag locked = ATOMIC_FLAG_INIT; };
+#define portMUX_INITIALIZER_UNLOCKED {}
+inline void portENTER_CRITICAL(portMUX_TYPE *mux) { while (mux->locked.test_and_set(std::memory_order_acquire)) std::this_thread::yield(); }
+inline void portEXIT_CRITICAL(portMUX_TYPE *mux) { mux->locked.clear(std::memory_order_release); }
+inline void portENTER_CRITICAL_ISR(portMUX_TYPE *mux) { portENTER_CRITICAL(mux); }
+inline void portEXIT_CRITICAL_ISR(portMUX_TYPE *mux) { portEXIT_CRITICAL(mux); }
+
+#endif
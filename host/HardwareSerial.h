@@ -0,0 +1,26 @@
+#ifndef MINI_LOGGER_HOST_HARDWARE_SERIAL_H
+#define MINI_LOGGER_HOST_HARDWARE_SERIAL_H
+
+#include "Arduino.h"
+
+#define SERIAL_8N1 0x800001c
+
+// The GPS UART: bytes the test queued, read by loop() only
+class HardwareSerial : public Stream {
+ public:
+  std::string rx;
+  explicit HardwareSerial(int) {}
+  void begin(unsigned long, int, int, int) {}
+  size_t setRxBufferSize(size_t n) { return n; }
+  int available() override { return (int)rx.size(); }
+  int read() override {
+    if (rx.empty()) return -1;
+    int c = (uint8_t)rx[0];
+    rx.erase(0, 1);
+    return c;
+  }
+  using Print::write;
+  size_t write(uint8_t) override { return 1; }
+};
+
+#endif
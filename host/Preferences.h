@@ -0,0 +1,23 @@
+#ifndef MINI_LOGGER_HOST_PREFERENCES_H
+#define MINI_LOGGER_HOST_PREFERENCES_H
+
+#include "Arduino.h"
+
+namespace sim { inline std::map<std::string, uint32_t> nvs; } // survives SD swaps, like flash
+
+class Preferences {
+ public:
+  bool begin(const char *name, bool = false, const char * = nullptr) { ns_ = name; return true; }
+  void end() {}
+  uint32_t getUInt(const char *key, uint32_t def = 0) {
+    auto it = sim::nvs.find(ns_ + "/" + key);
+    return it == sim::nvs.end() ? def : it->second;
+  }
+  size_t putUInt(const char *key, uint32_t v) { sim::nvs[ns_ + "/" + key] = v; return sizeof(v); }
+  bool remove(const char *key) { return sim::nvs.erase(ns_ + "/" + key) > 0; }
+
+ private:
+  std::string ns_;
+};
+
+#endif
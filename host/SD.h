@@ -0,0 +1,357 @@
+#ifndef MINI_LOGGER_HOST_SD_H
+#define MINI_LOGGER_HOST_SD_H
+
+#include <functional>
+#include <memory>
+#include <sys/types.h>
+#include "Arduino.h"
+#include "SPI.h"
+
+// In-memory SD cards for Log-test.cpp. A card keeps two copies of each file:
+// what reads see, and what has reached its sectors. As in FatFs, a write
+// goes to the card in whole sectors, except a partly written last sector that
+// waits in the file's buffer until the next write moves on, a seek, flush()
+// or close(); the directory entry's size is committed by flush() and close().
+// durableImage() is the card as a power cut would leave it.
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+#define SIM_SECTOR 512
+
+enum SeekMode { SeekSet, SeekCur, SeekEnd };
+typedef enum { CARD_NONE, CARD_MMC, CARD_SD, CARD_SDHC, CARD_UNKNOWN } sdcard_type_t;
+
+namespace sim {
+struct FileData {
+  std::vector<uint8_t> live;    // as reads see it
+  std::vector<uint8_t> disk;    // as the sectors hold it
+  size_t dirSize = 0;           // as the directory entry holds it
+};
+
+struct Card {
+  std::map<std::string, std::shared_ptr<FileData>> files; // by path, "/L25061400.CSV"
+  uint8_t sector0[SIM_SECTOR];
+  uint64_t bytes = 8ULL << 30;
+  uint32_t maxHz = 20000000;            // SD.begin() fails above this clock
+  double mountMs = 30;                  // SD.begin() time
+  std::vector<uint8_t> stale;           // byte i of unwritten file space reads as stale[i] (else 0)
+  std::function<double(size_t)> writeMs;  // time one write() of n bytes takes
+  bool failWrites = false;              // write() stores nothing and returns 0
+  // Called before a sector of a file reaches the card: path, file offset, new bytes, length
+  std::function<void(const std::string&, size_t, const uint8_t*, size_t)> beforeSector;
+  uint64_t sectorWrites = 0;            // sectors that reached the card
+  uint64_t writeCalls = 0;
+
+  explicit Card(uint32_t seed = 1) {
+    std::mt19937 r(seed);
+    for (uint8_t &b : sector0) b = (uint8_t)r();
+  }
+
+  uint8_t staleAt(size_t i) const { return i < stale.size() ? stale[i] : 0; }
+
+  // The card after a power cut: each file as its sectors hold it, cut or
+  // extended to the size its directory entry holds.
+  std::shared_ptr<Card> durableImage() const {
+    auto img = std::make_shared<Card>(*this);
+    img->beforeSector = nullptr;
+    img->writeMs = nullptr;
+    img->failWrites = false;
+    img->files.clear();
+    for (auto &kv : files) {
+      auto d = std::make_shared<FileData>();
+      d->disk = kv.second->disk;
+      size_t have = d->disk.size();
+      d->disk.resize(kv.second->dirSize);
+      for (size_t i = have; i < d->disk.size(); ++i) d->disk[i] = staleAt(i);
+      d->live = d->disk;
+      d->dirSize = d->disk.size();
+      img->files[kv.first] = d;
+    }
+    return img;
+  }
+};
+
+inline std::recursive_mutex fsMutex;
+inline std::shared_ptr<Card> slot;      // card in the slot
+inline std::shared_ptr<Card> mounted;   // card SD.begin() mounted
+inline uint64_t mountGen = 0;           // bumped by SD.begin() and SD.end()
+inline uint32_t mountHz = 0;
+inline uint32_t beginCalls = 0;
+inline std::vector<uint32_t> beginHz;   // clock of each SD.begin()
+inline thread_local uint32_t threadBeginCalls = 0; // SD.begin() calls by this thread
+
+struct Handle {
+  std::shared_ptr<Card> card;
+  std::shared_ptr<FileData> data;
+  std::string path;
+  uint64_t gen = 0;
+  size_t pos = 0;
+  bool canWrite = false, isDir = false, open = true;
+  long dirty = -1;                      // sector waiting in the file buffer
+  std::vector<std::string> listing;     // directory: paths in it
+  size_t next = 0;
+
+  bool ok() const { return open && gen == mountGen && mounted == card && slot == card; }
+
+  void grow(size_t size) {
+    while (data->live.size() < size) {
+      uint8_t b = card->staleAt(data->live.size());
+      data->live.push_back(b);
+      data->disk.push_back(b);
+    }
+  }
+
+  void writeSector(size_t sector) {
+    size_t off = sector * SIM_SECTOR;
+    if (off >= data->live.size()) return;
+    size_t len = data->live.size() - off < SIM_SECTOR ? data->live.size() - off : SIM_SECTOR;
+    if (card->beforeSector) card->beforeSector(path, off, data->live.data() + off, len);
+    memcpy(data->disk.data() + off, data->live.data() + off, len);
+    card->sectorWrites++;
+  }
+
+  void flushDirty() {
+    if (dirty < 0) return;
+    long s = dirty;
+    dirty = -1;
+    writeSector(s);
+  }
+};
+
+inline std::string basename(const std::string &path) {
+  size_t slash = path.rfind('/');
+  return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+inline void insert(std::shared_ptr<Card> card) { std::lock_guard<std::recursive_mutex> l(fsMutex); slot = card; }
+inline void eject() { std::lock_guard<std::recursive_mutex> l(fsMutex); slot = nullptr; }
+
+// Contents of a file as reads see them, or empty
+inline std::vector<uint8_t> fileBytes(const std::shared_ptr<Card> &card, const std::string &path) {
+  std::lock_guard<std::recursive_mutex> l(fsMutex);
+  auto it = card->files.find(path);
+  return it == card->files.end() ? std::vector<uint8_t>() : it->second->live;
+}
+} // namespace sim
+
+class File : public Stream {
+ public:
+  File() {}
+  explicit File(std::shared_ptr<sim::Handle> h) : h_(h) {}
+
+  operator bool() const { return h_ && h_->open; }
+  const char *path() const { return h_ ? h_->path.c_str() : ""; }
+  const char *name() const {
+    if (!h_) return "";
+    size_t slash = h_->path.rfind('/');
+    return h_->path.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+  }
+  bool isDirectory() { return h_ && h_->isDir; }
+
+  using Print::write;
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t *buf, size_t n) override {
+    double ms = 0;
+    size_t done = 0;
+    {
+      std::lock_guard<std::recursive_mutex> l(sim::fsMutex);
+      if (!h_ || !h_->ok() || !h_->canWrite) return 0;
+      sim::Card &card = *h_->card;
+      card.writeCalls++;
+      if (card.writeMs) ms = card.writeMs(n);
+      if (!card.failWrites && n > 0) {
+        size_t pos = h_->pos, end = pos + n;
+        h_->grow(end);
+        memcpy(h_->data->live.data() + pos, buf, n);
+        for (size_t s = pos / SIM_SECTOR; s <= (end - 1) / SIM_SECTOR; ++s) {
+          bool whole = pos <= s * SIM_SECTOR && end >= (s + 1) * SIM_SECTOR;
+          if (h_->dirty >= 0 && h_->dirty != (long)s) h_->flushDirty();
+          if (whole) { h_->dirty = -1; h_->writeSector(s); }
+          else h_->dirty = s;
+        }
+        h_->pos = end;
+        done = n;
+      }
+    }
+    sim::sleepMs(ms);
+    return done;
+  }
+
+  size_t read(uint8_t *buf, size_t n) {
+    std::lock_guard<std::recursive_mutex> l(sim::fsMutex);
+    if (!h_ || !h_->ok() || h_->isDir) return 0;
+    const std::vector<uint8_t> &v = h_->data->live;
+    size_t got = h_->pos >= v.size() ? 0 : (v.size() - h_->pos < n ? v.size() - h_->pos : n);
+    memcpy(buf, v.data() + h_->pos, got);
+    h_->pos += got;
+    return got;
+  }
+  int read() override { uint8_t c; return read(&c, 1) == 1 ? c : -1; }
+  int peek() override {
+    std::lock_guard<std::recursive_mutex> l(sim::fsMutex);
+    if (!h_ || !h_->ok() || h_->pos >= h_->data->live.size()) return -1;
+    return h_->data->live[h_->pos];
+  }
+  int available() override {
+    std::lock_guard<std::recursive_mutex> l(sim::fsMutex);
+    if (!h_ || !h_->ok()) return 0;
+    return h_->pos < h_->data->live.size() ? (int)(h_->data->live.size() - h_->pos) : 0;
+  }
+
+  // Past the end grows a file open for writing, as f_lseek() does
+  bool seek(uint32_t pos, SeekMode mode = SeekSet) {
+    std::lock_guard<std::recursive_mutex> l(sim::fsMutex);
+    if (!h_ || !h_->ok() || h_->isDir) return false;
+    size_t to = mode == SeekSet ? pos : mode == SeekCur ? h_->pos + pos : h_->data->live.size() + pos;
+    if (to > h_->data->live.size()) {
+      if (!h_->canWrite) return false;
+      h_->grow(to);
+    }
+    if (h_->dirty >= 0 && (size_t)h_->dirty != to / SIM_SECTOR) h_->flushDirty();
+    h_->pos = to;
+    return true;
+  }
+  size_t position() const { return h_ ? h_->pos : 0; }
+  size_t size() const { std::lock_guard<std::recursive_mutex> l(sim::fsMutex); return h_ ? h_->data->live.size() : 0; }
+
+  void flush() {
+    std::lock_guard<std::recursive_mutex> l(sim::fsMutex);
+    if (!h_ || !h_->ok() || !h_->canWrite) return;
+    h_->flushDirty();
+    h_->data->dirSize = h_->data->live.size();
+  }
+
+  void close() {
+    if (!h_) return;
+    flush();
+    h_->open = false;
+    h_.reset();
+  }
+
+  File openNextFile(const char *mode = FILE_READ);
+  void rewindDirectory() { if (h_) h_->next = 0; }
+
+ private:
+  std::shared_ptr<sim::Handle> h_;
+};
+
+class SDFS {
+ public:
+  bool begin(uint8_t = 5, SPIClass & = SPI, uint32_t hz = 4000000, const char * = "/sd", uint8_t = 5, bool = false) {
+    double ms;
+    {
+      std::lock_guard<std::recursive_mutex> l(sim::fsMutex);
+      sim::beginCalls++;
+      sim::threadBeginCalls++;
+      sim::beginHz.push_back(hz);
+      sim::mounted = nullptr;
+      sim::mountGen++;
+      if (!sim::slot) return false;
+      ms = sim::slot->mountMs;
+    }
+    sim::sleepMs(ms);
+    std::lock_guard<std::recursive_mutex> l(sim::fsMutex);
+    if (!sim::slot || hz > sim::slot->maxHz) return false;
+    sim::mounted = sim::slot;
+    sim::mountHz = hz;
+    return true;
+  }
+
+  void end() {
+    std::lock_guard<std::recursive_mutex> l(sim::fsMutex);
+    sim::mounted = nullptr;
+    sim::mountGen++;
+  }
+
+  bool ready() const { return sim::mounted && sim::mounted == sim::slot; }
+  sdcard_type_t cardType() { std::lock_guard<std::recursive_mutex> l(sim::fsMutex); return ready() ? CARD_SDHC : CARD_NONE; }
+  uint64_t cardSize() { std::lock_guard<std::recursive_mutex> l(sim::fsMutex); return ready() ? sim::mounted->bytes : 0; }
+  uint64_t totalBytes() { return cardSize(); }
+  uint64_t usedBytes() { return 0; }
+
+  bool readRAW(uint8_t *buf, uint32_t sector) {
+    std::lock_guard<std::recursive_mutex> l(sim::fsMutex);
+    if (!ready()) return false;
+    if (sector == 0) memcpy(buf, sim::mounted->sector0, SIM_SECTOR);
+    else memset(buf, 0, SIM_SECTOR);
+    return true;
+  }
+  bool writeRAW(uint8_t *, uint32_t) { return false; }
+
+  File open(const char *path, const char *mode = FILE_READ, bool = false) {
+    std::lock_guard<std::recursive_mutex> l(sim::fsMutex);
+    if (!ready()) return File();
+    sim::Card &card = *sim::mounted;
+    auto h = std::make_shared<sim::Handle>();
+    h->card = sim::mounted;
+    h->gen = sim::mountGen;
+    h->path = path;
+    if (h->path == "/") {
+      h->isDir = true;
+      for (auto &kv : card.files) h->listing.push_back(kv.first);
+      return File(h);
+    }
+    auto it = card.files.find(h->path);
+    bool create = mode[0] == 'w' || mode[0] == 'a';
+    if (it == card.files.end()) {
+      if (!create) return File();
+      it = card.files.emplace(h->path, std::make_shared<sim::FileData>()).first;
+    } else if (mode[0] == 'w') {
+      it->second->live.clear();
+      it->second->disk.clear();
+      it->second->dirSize = 0;
+    }
+    h->data = it->second;
+    h->canWrite = mode[0] != 'r' || mode[1] == '+';
+    if (mode[0] == 'a') h->pos = h->data->live.size();
+    return File(h);
+  }
+  File open(const String &path, const char *mode = FILE_READ, bool create = false) { return open(path.c_str(), mode, create); }
+
+  bool exists(const char *path) {
+    std::lock_guard<std::recursive_mutex> l(sim::fsMutex);
+    return ready() && (!strcmp(path, "/") || sim::mounted->files.count(path));
+  }
+  bool exists(const String &path) { return exists(path.c_str()); }
+  bool remove(const char *path) { std::lock_guard<std::recursive_mutex> l(sim::fsMutex); return ready() && sim::mounted->files.erase(path) > 0; }
+  bool remove(const String &path) { return remove(path.c_str()); }
+  bool rename(const char *from, const char *to) {
+    std::lock_guard<std::recursive_mutex> l(sim::fsMutex);
+    if (!ready() || !sim::mounted->files.count(from)) return false;
+    sim::mounted->files[to] = sim::mounted->files[from];
+    sim::mounted->files.erase(from);
+    return true;
+  }
+  bool mkdir(const char *) { return ready(); }
+};
+inline SDFS SD;
+
+inline File File::openNextFile(const char *mode) {
+  std::string path;
+  {
+    std::lock_guard<std::recursive_mutex> l(sim::fsMutex);
+    if (!h_ || !h_->isDir || !h_->ok()) return File();
+    while (h_->next < h_->listing.size() && !sim::mounted->files.count(h_->listing[h_->next])) h_->next++;
+    if (h_->next == h_->listing.size()) return File();
+    path = h_->listing[h_->next++];
+  }
+  return SD.open(path.c_str(), mode);
+}
+
+// truncate() on the VFS path of the mount; Log-test.cpp maps the sketch's call here
+inline int simTruncate(const char *vfsPath, off_t len) {
+  std::lock_guard<std::recursive_mutex> l(sim::fsMutex);
+  const char *path = strncmp(vfsPath, "/sd/", 4) == 0 ? vfsPath + 3 : vfsPath;
+  if (!SD.ready() || !sim::mounted->files.count(path)) return -1;
+  sim::FileData &d = *sim::mounted->files[path];
+  size_t n = (size_t)len;
+  size_t have = d.live.size();
+  d.live.resize(n);
+  d.disk.resize(n);
+  for (size_t i = have; i < n; ++i) d.live[i] = d.disk[i] = sim::mounted->staleAt(i);
+  d.dirSize = n;
+  return 0;
+}
+
+#endif
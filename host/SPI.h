@@ -0,0 +1,12 @@
+#ifndef MINI_LOGGER_HOST_SPI_H
+#define MINI_LOGGER_HOST_SPI_H
+
+#include "Arduino.h"
+
+class SPIClass {
+ public:
+  void begin(int, int, int, int) {}
+};
+inline SPIClass SPI;
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef MINI_LOGGER_HOST_TINYGPSPLUS_H
+#define MINI_LOGGER_HOST_TINYGPSPLUS_H
+
+#include "Arduino.h"
+
+// TinyGPSPlus without NMEA: the test queues whole fixes (sim::GpsFix) and a
+// '\n' on the UART for each; encode() applies one per '\n', as a sentence
+// ending would.
+struct RawDegrees {
+  uint16_t deg;
+  uint32_t billionths;
+  bool negative;
+};
+
+namespace sim {
+struct GpsFix {
+  uint16_t year; uint8_t month, day;
+  uint8_t hour, minute, second, centisecond;
+  int32_t latE7, lonE7;           // degrees * 1e7
+  int32_t knotsX100;
+  uint32_t satellites;
+};
+
+inline RawDegrees rawDegrees(int32_t e7) {
+  uint32_t v = e7 < 0 ? -(int64_t)e7 : e7;
+  return RawDegrees{(uint16_t)(v / 10000000), (v % 10000000) * 100, e7 < 0};
+}
+
+inline double degrees(const RawDegrees &r) {
+  double v = r.deg + r.billionths / 1000000000.0;
+  return r.negative ? -v : v;
+}
+} // namespace sim
+
+struct TinyGPSLocation {
+  bool valid = false, updated = false;
+  unsigned long at = 0;
+  RawDegrees latRaw = {}, lngRaw = {};
+  bool isValid() const { return valid; }
+  bool isUpdated() { bool u = updated; updated = false; return u; }
+  uint32_t age() const { return valid ? (uint32_t)(millis() - at) : 0xFFFFFFFFu; }
+  const RawDegrees &rawLat() { return latRaw; }
+  const RawDegrees &rawLng() { return lngRaw; }
+  double lat() { return sim::degrees(latRaw); }
+  double lng() { return sim::degrees(lngRaw); }
+};
+
+struct TinyGPSDate {
+  bool valid = false, updated = false;
+  unsigned long at = 0;
+  uint32_t date = 0;             // DDMMYY
+  bool isValid() const { return valid; }
+  bool isUpdated() { bool u = updated; updated = false; return u; }
+  uint32_t age() const { return valid ? (uint32_t)(millis() - at) : 0xFFFFFFFFu; }
+  uint32_t value() { return date; }
+  uint16_t year() { return date % 100 + 2000; }
+  uint8_t month() { return date / 100 % 100; }
+  uint8_t day() { return date / 10000; }
+};
+
+struct TinyGPSTime {
+  bool valid = false, updated = false;
+  unsigned long at = 0;
+  uint32_t time = 0;             // HHMMSSCC
+  bool isValid() const { return valid; }
+  bool isUpdated() { bool u = updated; updated = false; return u; }
+  uint32_t age() const { return valid ? (uint32_t)(millis() - at) : 0xFFFFFFFFu; }
+  uint32_t value() { return time; }
+  uint8_t hour() { return time / 1000000; }
+  uint8_t minute() { return time / 10000 % 100; }
+  uint8_t second() { return time / 100 % 100; }
+  uint8_t centisecond() { return time % 100; }
+};
+
+struct TinyGPSSpeed {
+  bool valid = false, updated = false;
+  unsigned long at = 0;
+  int32_t knotsX100 = 0;
+  bool isValid() const { return valid; }
+  bool isUpdated() { bool u = updated; updated = false; return u; }
+  uint32_t age() const { return valid ? (uint32_t)(millis() - at) : 0xFFFFFFFFu; }
+  int32_t value() { return knotsX100; }
+  double knots() { return knotsX100 / 100.0; }
+  double mph() { return knotsX100 * 0.0115077945; }
+  double mps() { return knotsX100 * 0.00514444444; }
+  double kmph() { return knotsX100 * 0.01852; }
+};
+
+struct TinyGPSInteger {
+  bool valid = false;
+  uint32_t v = 0;
+  bool isValid() const { return valid; }
+  uint32_t value() { return v; }
+};
+
+class TinyGPSPlus {
+ public:
+  TinyGPSLocation location;
+  TinyGPSDate date;
+  TinyGPSTime time;
+  TinyGPSSpeed speed;
+  TinyGPSInteger satellites;
+  std::deque<sim::GpsFix> pending;  // one per '\n' queued on the UART
+
+  bool encode(char c) {
+    chars_++;
+    if (c != '\n' || pending.empty()) return false;
+    apply(pending.front());
+    pending.pop_front();
+    return true;
+  }
+  uint32_t charsProcessed() const { return chars_; }
+  uint32_t sentencesWithFix() const { return fixes_; }
+  uint32_t failedChecksum() const { return 0; }
+  uint32_t passedChecksum() const { return fixes_; }
+
+ private:
+  void apply(const sim::GpsFix &f) {
+    unsigned long now = millis();
+    location.valid = location.updated = true;
+    location.at = now;
+    location.latRaw = sim::rawDegrees(f.latE7);
+    location.lngRaw = sim::rawDegrees(f.lonE7);
+    date.valid = date.updated = true;
+    date.at = now;
+    date.date = (f.day * 100 + f.month) * 100 + f.year % 100;
+    time.valid = time.updated = true;
+    time.at = now;
+    time.time = ((f.hour * 100 + f.minute) * 100 + f.second) * 100 + f.centisecond;
+    speed.valid = speed.updated = true;
+    speed.at = now;
+    speed.knotsX100 = f.knotsX100;
+    satellites.valid = true;
+    satellites.v = f.satellites;
+    fixes_++;
+  }
+  uint32_t chars_ = 0, fixes_ = 0;
+};
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef MINI_LOGGER_HOST_WIRE_H
+#define MINI_LOGGER_HOST_WIRE_H
+
+#include "Arduino.h"
+
+class TwoWire {
+ public:
+  void begin(int, int) {}
+};
+inline TwoWire Wire;
+
+#endif